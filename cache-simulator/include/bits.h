@@ -2,8 +2,16 @@
 #define BITS_H_
 #include "cache.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 int get_set(Cache *cache, address_type address);
 int get_line(Cache *cache, address_type address);
 int get_byte(Cache *cache, address_type address);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* BITS_H_ */
\ No newline at end of file
@@ -1,5 +1,6 @@
 #ifndef __CACHE_H
 #define __CACHE_H
+#include <stddef.h>
 #include "trace.h"
 
 // Forward declaration of types:
@@ -16,6 +17,13 @@ typedef struct LRUResult LRUResult;
 enum AccessResult { HIT, COLD_MISS, CONFLICT_MISS };
 typedef enum AccessResult AccessResult;
 
+// Aggregate outcome of a batch of accesses.
+typedef struct {
+  long hits;
+  long cold;
+  long conflict;
+} AccessStats;
+
 /*** LRU Data Structures ***/
 
 // Represents a node in the LRU queue/stack linked list.
@@ -58,11 +66,47 @@ struct Cache {
   int block_bits;  // The number of bits used to index a byte in a block
 };
 
+// The line touched by the previous access and the block it holds. While
+// accesses stay inside that block they are guaranteed hits on that line.
+typedef struct {
+  Line *line;  // NULL before the first access
+  address_type block;
+} MRUState;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 Cache *make_cache(int set_count, int line_count, int block_size);
 void delete_cache(Cache *cache);
 int get_set(Cache *cache, address_type address);
 int get_line(Cache *cache, address_type address);
 int get_byte(Cache *cache, address_type address);
 AccessResult cache_access(Cache *cache, TraceLine *trace_line);
+void cache_access_batch(Cache *cache, const address_type *addresses,
+                        const char *operations, size_t count,
+                        AccessResult *results, AccessStats *stats);
+
+// cache_access with the same-block fast path shared by cpu_access and
+// cache_access_batch: a run of accesses to the MRU block only marks the
+// accessed byte instead of walking the set and the LRU order again.
+static inline AccessResult cache_access_mru(Cache *cache, MRUState *mru,
+                                            TraceLine *trace_line) {
+  address_type block = trace_line->address >> cache->block_bits;
+  if (mru->line != NULL && block == mru->block) {
+    mru->line->accessed[get_byte(cache, trace_line->address)] = 1;
+    return HIT;
+  }
+
+  AccessResult result = cache_access(cache, trace_line);
+  // cache_access always leaves the accessed line at the front of its set.
+  mru->line = &cache->sets[get_set(cache, trace_line->address)].lines[0];
+  mru->block = block;
+  return result;
+}
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
\ No newline at end of file
@@ -0,0 +1,81 @@
+#ifndef __CACHE_HPP
+#define __CACHE_HPP
+#include <new>
+#include <utility>
+#include <vector>
+#include "cache.h"
+
+namespace cachesim {
+
+// Owns one simulated cache. Instances share no state, so independent
+// caches can be driven from separate threads; a single instance must not
+// be used from two threads at once.
+class CacheSim {
+ public:
+  CacheSim(int set_bits, int line_count, int block_bits)
+      : cache_(make_cache(set_bits, line_count, block_bits)), stats_() {
+    if (cache_ == nullptr) {
+      throw std::bad_alloc();
+    }
+  }
+
+  ~CacheSim() {
+    if (cache_ != nullptr) {
+      delete_cache(cache_);
+    }
+  }
+
+  CacheSim(const CacheSim &) = delete;
+  CacheSim &operator=(const CacheSim &) = delete;
+
+  CacheSim(CacheSim &&other) noexcept
+      : cache_(std::exchange(other.cache_, nullptr)), stats_(other.stats_) {}
+
+  CacheSim &operator=(CacheSim &&other) noexcept {
+    std::swap(cache_, other.cache_);
+    std::swap(stats_, other.stats_);
+    return *this;
+  }
+
+  // Simulates one access.
+  AccessResult access(address_type address, char operation = 'L') {
+    AccessResult result;
+    cache_access_batch(cache_, &address, &operation, 1, &result, &stats_);
+    return result;
+  }
+
+  // Simulates `count` accesses. `operations` and `results` may be null;
+  // returns the outcome of this batch alone.
+  AccessStats access(const address_type *addresses, size_t count,
+                     const char *operations = nullptr,
+                     AccessResult *results = nullptr) {
+    AccessStats batch = AccessStats();
+    cache_access_batch(cache_, addresses, operations, count, results, &batch);
+    stats_.hits += batch.hits;
+    stats_.cold += batch.cold;
+    stats_.conflict += batch.conflict;
+    return batch;
+  }
+
+  AccessStats access(const std::vector<address_type> &addresses,
+                     std::vector<AccessResult> *results = nullptr) {
+    if (results != nullptr) {
+      results->resize(addresses.size());
+    }
+    return access(addresses.data(), addresses.size(), nullptr,
+                  results != nullptr ? results->data() : nullptr);
+  }
+
+  // Totals over every access since construction.
+  const AccessStats &stats() const { return stats_; }
+
+  Cache *get() { return cache_; }
+
+ private:
+  Cache *cache_;
+  AccessStats stats_;
+};
+
+}  // namespace cachesim
+
+#endif
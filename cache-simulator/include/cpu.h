@@ -2,6 +2,7 @@
 #define __CPU_H
 #include <stdio.h>
 #include "cache.h"
+#include "profile.h"
 #include "trace.h"
 
 typedef struct {
@@ -11,10 +12,22 @@ typedef struct {
   int hits;
   int cold;
   int conflict;
+  MRUState mru;  // Same-block fast path state, see cache_access_mru
 } CPU;
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 CPU *make_cpu(Cache *cache, const char *address_trace_file);
 void delete_cpu(CPU *cpu);
+AccessResult cpu_access(CPU *cpu, TraceLine *trace_line);
 void run_cpu(CPU *cpu);
+void profile_cpu(CPU *cpu, Profile *profile);
+void replay_trace(CPU *cpu, const Trace *trace);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
\ No newline at end of file
@@ -2,8 +2,16 @@
 #define __LRU_H
 #include "cache.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 void lru_init(Cache *cache);
 void lru_destroy(Cache *cache);
 void lru_fetch(Set *set, unsigned int tag, LRUResult *result);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
\ No newline at end of file
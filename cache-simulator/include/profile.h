@@ -0,0 +1,84 @@
+#ifndef __PROFILE_H
+#define __PROFILE_H
+#include <stdio.h>
+#include "cache.h"
+#include "trace.h"
+
+// Reuse distances are bucketed by powers of two: bucket 0 holds distance 0,
+// bucket k holds distances in [2^(k-1), 2^k).
+#define REUSE_BUCKETS 34
+
+typedef struct BlockEntry BlockEntry;
+typedef struct RegionEntry RegionEntry;
+typedef struct Profile Profile;
+
+// Per-block state, kept in an open addressing table.
+struct BlockEntry {
+  address_type block;
+  int slot;    // position of the block's last access in the recency tree
+  int window;  // last working-set window the block was seen in
+  char used;
+};
+
+// Per-region access and miss counts, kept in an open addressing table.
+struct RegionEntry {
+  address_type region;
+  long accesses;
+  long cold;
+  long conflict;
+  char used;
+};
+
+// Explains why a trace misses: how far apart reuses of a block are, how
+// many distinct blocks each window of the trace touches, and which address
+// regions the misses come from.
+//
+// Reuse distance (the number of distinct blocks touched since the last
+// access to the same block) is computed with a Fenwick tree over "last
+// access" slots. Only the most recent slot of every block is live, and
+// the tree is compacted whenever it fills up, so memory stays proportional
+// to the number of unique blocks rather than the length of the trace.
+struct Profile {
+  int block_bits;   // a block is address >> block_bits
+  int region_bits;  // a region is address >> region_bits
+  int window;       // accesses per working-set window
+
+  long accesses;
+  long cold;                       // first touches of a block
+  long histogram[REUSE_BUCKETS];   // reuse distances of the other accesses
+
+  BlockEntry *blocks;  // block table
+  int block_capacity;
+  int block_count;
+
+  int *tree;                // Fenwick tree over slots, 1 = live slot
+  address_type *slot_block;  // block that owns each slot
+  int slot_capacity;
+  int next_slot;
+
+  int current_window;
+  int window_blocks;     // distinct blocks seen in the current window
+  int *working_set;      // distinct blocks of each finished window
+  int window_count;
+  int window_capacity;
+
+  RegionEntry *regions;  // region table
+  int region_capacity;
+  int region_count;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+Profile *make_profile(int block_bits, int region_bits, int window);
+void delete_profile(Profile *profile);
+void profile_access(Profile *profile, address_type address,
+                    AccessResult result);
+void print_profile(Profile *profile, FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef __SERVER_H
+#define __SERVER_H
+#include <pthread.h>
+#include <sys/types.h>
+#include <time.h>
+#include "trace.h"
+
+/*** Simulation Server ***/
+
+// The server keeps every trace it has been asked about decoded in memory
+// and answers cache configuration queries against them. Clients talk to it
+// over a Unix domain socket, one query per line:
+//
+//   <trace_file> <set_bits> <lines> <block_bits> [policy]
+//
+// and receive one line per query, tagged with the query's position on the
+// connection (starting at 1) since answers come back as workers finish:
+//
+//   <n> hits: H misses: M evictions: E hrate: R mrate: R cached: 0|1
+//   <n> error: <reason>
+
+typedef struct Query Query;
+typedef struct Client Client;
+typedef struct TraceEntry TraceEntry;
+typedef struct ResultEntry ResultEntry;
+typedef struct Server Server;
+
+// A client connection. It stays open until the reader has seen EOF and
+// every query it submitted has been answered.
+struct Client {
+  int fd;
+  int refs;                     // reader + outstanding queries
+  pthread_mutex_t write_lock;   // keeps answer lines whole
+  Server *server;
+};
+
+// One parsed query waiting for a worker.
+struct Query {
+  Client *client;
+  int seq;           // position of the query on its connection
+  char *trace_file;
+  int set_bits;
+  int line_count;
+  int block_bits;
+  Query *next;
+};
+
+// A trace kept resident, keyed by the path it was loaded from and the size
+// and modification time the file had then. An entry whose file has changed
+// is dropped from the list and freed once no worker uses it any more.
+struct TraceEntry {
+  char *trace_file;
+  off_t size;
+  struct timespec mtime;
+  Trace *trace;  // NULL while loading, or if the load failed
+  int loading;   // a worker is decoding the file outside trace_lock
+  int refs;      // the list's + workers replaying it
+  TraceEntry *next;
+};
+
+// A finished simulation, keyed by trace hash and cache geometry.
+struct ResultEntry {
+  unsigned long trace_hash;
+  int set_bits;
+  int line_count;
+  int block_bits;
+  int hits;
+  int cold;
+  int conflict;
+  ResultEntry *next;
+};
+
+struct Server {
+  int listen_fd;
+  int worker_count;
+  pthread_t *workers;
+
+  Query *queue_head;  // FIFO of queries waiting for a worker
+  Query *queue_tail;
+  pthread_mutex_t queue_lock;
+  pthread_cond_t queue_ready;
+
+  TraceEntry *traces;  // resident traces
+  pthread_mutex_t trace_lock;
+  pthread_cond_t trace_loaded;  // some entry stopped loading
+
+  ResultEntry **results;  // result cache buckets, most recently used first
+  int result_buckets;
+  int results_per_bucket;  // older entries past this are evicted
+  pthread_mutex_t result_lock;
+};
+
+Server *make_server(const char *socket_path, int worker_count);
+void run_server(Server *server);
+
+#endif
@@ -9,4 +9,23 @@ typedef struct {
   char size;
 } TraceLine;
 
-#endif
\ No newline at end of file
+// A whole address trace decoded into memory, so it can be replayed against
+// many caches without touching the file again.
+typedef struct {
+  TraceLine *lines;    // The decoded accesses, in trace order
+  int count;           // The number of accesses
+  unsigned long hash;  // FNV-1a hash of the decoded accesses
+} Trace;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+Trace *load_trace(const char *address_trace_file);
+void delete_trace(Trace *trace);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
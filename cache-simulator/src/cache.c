@@ -119,4 +119,31 @@ AccessResult cache_access(Cache *cache, TraceLine *trace_line) {
   line->accessed[b] = 1;
 
   return result.access;
-}
\ No newline at end of file
+}
+void cache_access_batch(Cache *cache, const address_type *addresses,
+                        const char *operations, size_t count,
+                        AccessResult *results, AccessStats *stats) {
+  // The MRU state is local to the call so independent caches share nothing.
+  MRUState mru = {NULL, 0};
+  TraceLine trace_line;
+  trace_line.size = 0;
+
+  for (size_t i = 0; i < count; i++) {
+    trace_line.operation = operations != NULL ? operations[i] : 'L';
+    trace_line.address = addresses[i];
+    AccessResult result = cache_access_mru(cache, &mru, &trace_line);
+
+    if (results != NULL) {
+      results[i] = result;
+    }
+    if (stats != NULL) {
+      if (result == HIT) {
+        stats->hits++;
+      } else if (result == COLD_MISS) {
+        stats->cold++;
+      } else {
+        stats->conflict++;
+      }
+    }
+  }
+}
@@ -0,0 +1,26 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "server.h"
+
+int main(int argc, char *argv[]) {
+  if (argc < 2 || argc > 3) {
+    fprintf(stderr, "Usage: %s <socket_path> [workers]\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  int workers = argc == 3 ? atoi(argv[2]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (workers <= 0) {
+    fprintf(stderr, "workers must be a positive integer\n");
+    exit(EXIT_FAILURE);
+  }
+
+  Server *server = make_server(argv[1], workers);
+  if (server == NULL) {
+    exit(EXIT_FAILURE);
+  }
+  printf("listening on %s with %d workers\n", argv[1], workers);
+  fflush(stdout);
+  run_server(server);
+  exit(EXIT_FAILURE);
+}
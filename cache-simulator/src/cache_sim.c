@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <unistd.h>
 #include "cache.h"
 #include "cpu.h"
 #include "lru.h"
@@ -113,7 +114,59 @@ void test2() {
 
 }  
 
+void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-p] [-r region_bits] [-w window] "
+            "<set_bits> <lines> <block_bits> <trace_file>\n"
+            "  -p              profile reuse distance, working set and "
+            "misses per region\n"
+            "  -r region_bits  region size for miss attribution (default 20, 1 MB)\n"
+            "  -w window       accesses per working-set window (default 100000)\n",
+            prog);
+    exit(EXIT_FAILURE);
+}
+
 int main(int argc, char *argv[]) {
-    test2();
-    printf("test ok");
+    int profile_mode = 0;
+    int region_bits = 20;
+    int window = 100000;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "pr:w:")) != -1) {
+        if (opt == 'p') {
+            profile_mode = 1;
+        } else if (opt == 'r') {
+            region_bits = atoi(optarg);
+        } else if (opt == 'w') {
+            window = atoi(optarg);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (argc - optind != 4 || region_bits < 0 || region_bits > 31 || window <= 0) {
+        usage(argv[0]);
+    }
+
+    int sets = atoi(argv[optind]);
+    int lines = atoi(argv[optind + 1]);
+    int bytes = atoi(argv[optind + 2]);
+    const char *trace_file = argv[optind + 3];
+
+    Cache *cache = make_cache(sets, lines, bytes);
+    CPU *cpu = make_cpu(cache, trace_file);
+    if (cpu->address_trace == NULL) {
+        perror(trace_file);
+        exit(EXIT_FAILURE);
+    }
+
+    if (profile_mode) {
+        Profile *profile = make_profile(bytes, region_bits, window);
+        profile_cpu(cpu, profile);
+        delete_profile(profile);
+    } else {
+        run_cpu(cpu);
+    }
+
+    delete_cpu(cpu);
+    delete_cache(cache);
 }
\ No newline at end of file
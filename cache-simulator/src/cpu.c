@@ -1,6 +1,7 @@
 #include "cpu.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include "bits.h"
 #include "cache.h"
 
 int read_address(CPU *cpu, TraceLine *trace_line) {
@@ -15,30 +16,66 @@ CPU *make_cpu(Cache *cache, const char *address_trace_file) {
   cpu->hits = 0;
   cpu->cold = 0;
   cpu->conflict = 0;
-  cpu->address_trace = fopen(address_trace_file, "r");
+  cpu->mru.line = NULL;
+  cpu->mru.block = 0;
+  cpu->address_trace = NULL;
+  if (address_trace_file != NULL) {
+    cpu->address_trace = fopen(address_trace_file, "r");
+  }
   return cpu;
 }
 
-void delete_cpu(CPU *cpu) { free(cpu); }
+void delete_cpu(CPU *cpu) {
+  if (cpu->address_trace != NULL) {
+    fclose(cpu->address_trace);
+  }
+  free(cpu);
+}
 
-void run_cpu(CPU *cpu) {
-  TraceLine trace_line;
-  while (read_address(cpu, &trace_line) != EOF) {
-    cpu->address_count++;
-    AccessResult result = cache_access(cpu->cache, &trace_line);
-    if (result == HIT) {
-      cpu->hits++;
-    } else if (result == COLD_MISS) {
-      cpu->cold++;
-    } else {
-      cpu->conflict++;
-    }
+AccessResult cpu_access(CPU *cpu, TraceLine *trace_line) {
+  cpu->address_count++;
+
+  AccessResult result = cache_access_mru(cpu->cache, &cpu->mru, trace_line);
+  if (result == HIT) {
+    cpu->hits++;
+  } else if (result == COLD_MISS) {
+    cpu->cold++;
+  } else {
+    cpu->conflict++;
   }
+  return result;
+}
 
+static void print_cpu(CPU *cpu) {
   int miss = cpu->cold + cpu->conflict;
   float hit_rate = ((float)(cpu->hits)) / ((float)(cpu->hits + miss));
   float miss_rate = 1.0f - hit_rate;
 
   printf("hits: %d misses: %d evictions: %d hrate: %f mrate: %f\n", cpu->hits,
          cpu->cold + cpu->conflict, cpu->conflict, hit_rate, miss_rate);
-}
\ No newline at end of file
+}
+
+void run_cpu(CPU *cpu) {
+  TraceLine trace_line;
+  while (read_address(cpu, &trace_line) != EOF) {
+    cpu_access(cpu, &trace_line);
+  }
+  print_cpu(cpu);
+}
+
+void profile_cpu(CPU *cpu, Profile *profile) {
+  TraceLine trace_line;
+  while (read_address(cpu, &trace_line) != EOF) {
+    AccessResult result = cpu_access(cpu, &trace_line);
+    profile_access(profile, trace_line.address, result);
+  }
+  print_cpu(cpu);
+  print_profile(profile, stdout);
+}
+
+void replay_trace(CPU *cpu, const Trace *trace) {
+  for (int i = 0; i < trace->count; i++) {
+    TraceLine trace_line = trace->lines[i];
+    cpu_access(cpu, &trace_line);
+  }
+}
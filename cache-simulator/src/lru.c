@@ -44,14 +44,11 @@ void lru_fetch(Set *set, unsigned int tag, LRUResult *result) {
   // the cache should be accessed.
   //
   result->access = CONFLICT_MISS;
-  char flag = 0;
+  int found = set->line_count - 1;  // the line that moves to the front
   for(int i = 0; i < set->line_count; ++i) {
     Line* line = &set->lines[i];
     if (line->valid && line->tag == tag) {
-      for(int j = i; j > 0; --j) {
-        set->lines[j] = set->lines[j - 1];
-      }
-      flag = 1;
+      found = i;
       result->access = HIT;
       break;
     }
@@ -61,11 +58,12 @@ void lru_fetch(Set *set, unsigned int tag, LRUResult *result) {
     }
   }
 
-  if (flag == 0) {
-    for(int j = set->line_count - 1; j > 0; --j) {
-      set->lines[j] = set->lines[j - 1];
-    }
+  // Rotate rather than shift so every line keeps its own accessed block.
+  Line front = set->lines[found];
+  for(int j = found; j > 0; --j) {
+    set->lines[j] = set->lines[j - 1];
   }
+  set->lines[0] = front;
   set->lines[0].valid = 1;
   set->lines[0].tag = tag;
   result->line = &set->lines[0];
@@ -0,0 +1,307 @@
+#include "profile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TOP_REGIONS 16
+
+static unsigned int hash_address(address_type key) {
+  return key * 2654435761u;
+}
+
+/*** Fenwick tree over last-access slots ***/
+
+static void tree_add(Profile *profile, int slot, int delta) {
+  for (int i = slot + 1; i <= profile->slot_capacity; i += i & -i) {
+    profile->tree[i] += delta;
+  }
+}
+
+// Number of live slots in [0, slot].
+static int tree_prefix(Profile *profile, int slot) {
+  int sum = 0;
+  for (int i = slot + 1; i > 0; i -= i & -i) {
+    sum += profile->tree[i];
+  }
+  return sum;
+}
+
+/*** Block and region tables ***/
+
+static BlockEntry *find_block(Profile *profile, address_type block) {
+  unsigned int mask = profile->block_capacity - 1;
+  unsigned int i = hash_address(block) & mask;
+  while (profile->blocks[i].used && profile->blocks[i].block != block) {
+    i = (i + 1) & mask;
+  }
+  return &profile->blocks[i];
+}
+
+static void grow_blocks(Profile *profile) {
+  BlockEntry *old = profile->blocks;
+  int old_capacity = profile->block_capacity;
+  profile->block_capacity *= 2;
+  profile->blocks =
+      (BlockEntry *)calloc(profile->block_capacity, sizeof(BlockEntry));
+  for (int i = 0; i < old_capacity; i++) {
+    if (old[i].used) {
+      *find_block(profile, old[i].block) = old[i];
+    }
+  }
+  free(old);
+}
+
+static RegionEntry *find_region(Profile *profile, address_type region) {
+  unsigned int mask = profile->region_capacity - 1;
+  unsigned int i = hash_address(region) & mask;
+  while (profile->regions[i].used && profile->regions[i].region != region) {
+    i = (i + 1) & mask;
+  }
+  return &profile->regions[i];
+}
+
+static void grow_regions(Profile *profile) {
+  RegionEntry *old = profile->regions;
+  int old_capacity = profile->region_capacity;
+  profile->region_capacity *= 2;
+  profile->regions =
+      (RegionEntry *)calloc(profile->region_capacity, sizeof(RegionEntry));
+  for (int i = 0; i < old_capacity; i++) {
+    if (old[i].used) {
+      *find_region(profile, old[i].region) = old[i];
+    }
+  }
+  free(old);
+}
+
+// Renumbers the live slots 0..n-1 in recency order, growing the tree when
+// more than half of it would still be live afterwards.
+static void compact_slots(Profile *profile) {
+  int capacity = profile->slot_capacity;
+  while ((profile->block_count + 1) * 2 > capacity) {
+    capacity *= 2;
+  }
+
+  address_type *slot_block =
+      (address_type *)malloc(sizeof(address_type) * capacity);
+  int live = 0;
+  for (int i = 0; i < profile->next_slot; i++) {
+    BlockEntry *entry = find_block(profile, profile->slot_block[i]);
+    if (entry->slot == i) {
+      entry->slot = live;
+      slot_block[live++] = profile->slot_block[i];
+    }
+  }
+  free(profile->slot_block);
+  profile->slot_block = slot_block;
+
+  free(profile->tree);
+  profile->slot_capacity = capacity;
+  profile->tree = (int *)calloc(capacity + 1, sizeof(int));
+  for (int i = 1; i <= capacity; i++) {
+    profile->tree[i] += i <= live;
+    int parent = i + (i & -i);
+    if (parent <= capacity) {
+      profile->tree[parent] += profile->tree[i];
+    }
+  }
+  profile->next_slot = live;
+}
+
+static int reuse_bucket(int distance) {
+  int bucket = 0;
+  while (distance > 0) {
+    bucket++;
+    distance >>= 1;
+  }
+  return bucket;
+}
+
+static void push_window(Profile *profile) {
+  if (profile->window_count == profile->window_capacity) {
+    profile->window_capacity *= 2;
+    profile->working_set = (int *)realloc(
+        profile->working_set, sizeof(int) * profile->window_capacity);
+  }
+  profile->working_set[profile->window_count++] = profile->window_blocks;
+  profile->window_blocks = 0;
+}
+
+/*** Profile ***/
+
+Profile *make_profile(int block_bits, int region_bits, int window) {
+  Profile *profile = (Profile *)malloc(sizeof(Profile));
+  profile->block_bits = block_bits;
+  profile->region_bits = region_bits;
+  profile->window = window;
+
+  profile->accesses = 0;
+  profile->cold = 0;
+  memset(profile->histogram, 0, sizeof(profile->histogram));
+
+  profile->block_capacity = 1024;
+  profile->block_count = 0;
+  profile->blocks =
+      (BlockEntry *)calloc(profile->block_capacity, sizeof(BlockEntry));
+
+  profile->slot_capacity = 1024;
+  profile->next_slot = 0;
+  profile->tree = (int *)calloc(profile->slot_capacity + 1, sizeof(int));
+  profile->slot_block =
+      (address_type *)malloc(sizeof(address_type) * profile->slot_capacity);
+
+  profile->current_window = 0;
+  profile->window_blocks = 0;
+  profile->window_count = 0;
+  profile->window_capacity = 64;
+  profile->working_set = (int *)malloc(sizeof(int) * profile->window_capacity);
+
+  profile->region_capacity = 64;
+  profile->region_count = 0;
+  profile->regions =
+      (RegionEntry *)calloc(profile->region_capacity, sizeof(RegionEntry));
+  return profile;
+}
+
+void delete_profile(Profile *profile) {
+  free(profile->blocks);
+  free(profile->tree);
+  free(profile->slot_block);
+  free(profile->working_set);
+  free(profile->regions);
+  free(profile);
+}
+
+// Records the reuse distance of an access to `block` and makes it the
+// newest live slot.
+static void record_reuse(Profile *profile, address_type block, int window) {
+  if ((profile->block_count + 1) * 2 > profile->block_capacity) {
+    grow_blocks(profile);
+  }
+  BlockEntry *entry = find_block(profile, block);
+  if (!entry->used) {
+    entry->used = 1;
+    entry->block = block;
+    entry->window = -1;
+    profile->block_count++;
+    profile->cold++;
+  } else {
+    // Every live slot after this one belongs to a distinct block touched
+    // since the last access.
+    int distance = profile->block_count - tree_prefix(profile, entry->slot);
+    profile->histogram[reuse_bucket(distance)]++;
+    tree_add(profile, entry->slot, -1);
+  }
+  entry->slot = -1;
+
+  if (entry->window != window) {
+    entry->window = window;
+    profile->window_blocks++;
+  }
+
+  if (profile->next_slot == profile->slot_capacity) {
+    compact_slots(profile);
+  }
+  entry->slot = profile->next_slot++;
+  profile->slot_block[entry->slot] = block;
+  tree_add(profile, entry->slot, 1);
+}
+
+void profile_access(Profile *profile, address_type address,
+                    AccessResult result) {
+  address_type block = address >> profile->block_bits;
+  int window = profile->accesses / profile->window;
+  profile->accesses++;
+
+  // Repeated touches of the newest block within a window are distance 0
+  // and change neither the recency order nor the working set.
+  if (window == profile->current_window && profile->next_slot > 0 &&
+      profile->slot_block[profile->next_slot - 1] == block) {
+    profile->histogram[0]++;
+  } else {
+    if (window != profile->current_window) {
+      push_window(profile);
+      profile->current_window = window;
+    }
+    record_reuse(profile, block, window);
+  }
+
+  if ((profile->region_count + 1) * 2 > profile->region_capacity) {
+    grow_regions(profile);
+  }
+  address_type region_index = address >> profile->region_bits;
+  RegionEntry *region = find_region(profile, region_index);
+  if (!region->used) {
+    region->used = 1;
+    region->region = region_index;
+    profile->region_count++;
+  }
+  region->accesses++;
+  if (result == COLD_MISS) {
+    region->cold++;
+  } else if (result == CONFLICT_MISS) {
+    region->conflict++;
+  }
+}
+
+static int compare_region_misses(const void *a, const void *b) {
+  const RegionEntry *x = (const RegionEntry *)a;
+  const RegionEntry *y = (const RegionEntry *)b;
+  long x_misses = x->cold + x->conflict;
+  long y_misses = y->cold + y->conflict;
+  if (x_misses != y_misses) {
+    return x_misses < y_misses ? 1 : -1;
+  }
+  return x->region < y->region ? -1 : x->region > y->region;
+}
+
+void print_profile(Profile *profile, FILE *out) {
+  fprintf(out, "accesses: %ld unique blocks: %d\n", profile->accesses,
+          profile->block_count);
+
+  fprintf(out, "reuse distance (blocks):\n");
+  fprintf(out, "  %-24s %ld\n", "cold", profile->cold);
+  for (int i = 0; i < REUSE_BUCKETS; i++) {
+    if (profile->histogram[i] == 0) continue;
+    char range[32];
+    if (i <= 1) {
+      snprintf(range, sizeof(range), "%d", i);
+    } else {
+      snprintf(range, sizeof(range), "%lu-%lu", 1UL << (i - 1),
+               (1UL << i) - 1);
+    }
+    fprintf(out, "  %-24s %ld\n", range, profile->histogram[i]);
+  }
+
+  fprintf(out, "working set (distinct blocks per %d accesses):\n",
+          profile->window);
+  for (int i = 0; i < profile->window_count; i++) {
+    fprintf(out, "  %d: %d\n", i, profile->working_set[i]);
+  }
+  if (profile->accesses > 0) {
+    fprintf(out, "  %d: %d\n", profile->window_count, profile->window_blocks);
+  }
+
+  RegionEntry *regions =
+      (RegionEntry *)malloc(sizeof(RegionEntry) * (profile->region_count + 1));
+  int count = 0;
+  for (int i = 0; i < profile->region_capacity; i++) {
+    if (profile->regions[i].used) {
+      regions[count++] = profile->regions[i];
+    }
+  }
+  qsort(regions, count, sizeof(RegionEntry), compare_region_misses);
+
+  fprintf(out, "misses by region (%lu-byte regions, top %d of %d):\n",
+          1UL << profile->region_bits,
+          count < TOP_REGIONS ? count : TOP_REGIONS, count);
+  for (int i = 0; i < count && i < TOP_REGIONS; i++) {
+    unsigned long start = (unsigned long)regions[i].region
+                          << profile->region_bits;
+    unsigned long end = start + (1UL << profile->region_bits) - 1;
+    fprintf(out, "  %08lx-%08lx accesses: %ld misses: %ld cold: %ld conflict: %ld\n",
+            start, end, regions[i].accesses, regions[i].cold + regions[i].conflict,
+            regions[i].cold, regions[i].conflict);
+  }
+  free(regions);
+}
@@ -0,0 +1,435 @@
+#include "server.h"
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "cache.h"
+#include "cpu.h"
+
+#define RESULT_BUCKETS 1024
+#define RESULTS_PER_BUCKET 8
+#define MAX_QUERY_LINE 4096
+
+// Largest cache we agree to build for a query, in bytes of accessed bits.
+#define MAX_CACHE_BYTES (1L << 28)
+
+static void write_line(Client *client, const char *line) {
+  pthread_mutex_lock(&client->write_lock);
+  size_t total = 0, count = strlen(line);
+  while (total < count) {
+    ssize_t n = write(client->fd, line + total, count - total);
+    if (n == -1) {
+      if (errno == EINTR) continue;
+      break;  // client went away; its remaining answers are dropped
+    }
+    total += n;
+  }
+  pthread_mutex_unlock(&client->write_lock);
+}
+
+static void release_client(Client *client) {
+  Server *server = client->server;
+  pthread_mutex_lock(&server->queue_lock);
+  int refs = --client->refs;
+  pthread_mutex_unlock(&server->queue_lock);
+
+  if (refs == 0) {
+    close(client->fd);
+    pthread_mutex_destroy(&client->write_lock);
+    free(client);
+  }
+}
+
+static void push_query(Server *server, Query *query) {
+  pthread_mutex_lock(&server->queue_lock);
+  query->client->refs++;
+  query->next = NULL;
+  if (server->queue_tail == NULL) {
+    server->queue_head = query;
+  } else {
+    server->queue_tail->next = query;
+  }
+  server->queue_tail = query;
+  pthread_cond_signal(&server->queue_ready);
+  pthread_mutex_unlock(&server->queue_lock);
+}
+
+static Query *pop_query(Server *server) {
+  pthread_mutex_lock(&server->queue_lock);
+  while (server->queue_head == NULL) {
+    pthread_cond_wait(&server->queue_ready, &server->queue_lock);
+  }
+  Query *query = server->queue_head;
+  server->queue_head = query->next;
+  if (server->queue_head == NULL) {
+    server->queue_tail = NULL;
+  }
+  pthread_mutex_unlock(&server->queue_lock);
+  return query;
+}
+
+// Drops one reference to an entry, freeing it with the last. Called with
+// trace_lock held.
+static void put_trace(TraceEntry *entry) {
+  if (--entry->refs == 0) {
+    if (entry->trace != NULL) {
+      delete_trace(entry->trace);
+    }
+    free(entry->trace_file);
+    free(entry);
+  }
+}
+
+// Removes an entry from the resident list; workers still replaying it keep
+// it alive. Called with trace_lock held.
+static void unlink_trace(Server *server, TraceEntry *entry) {
+  TraceEntry **link = &server->traces;
+  while (*link != NULL && *link != entry) {
+    link = &(*link)->next;
+  }
+  if (*link == NULL) {
+    return;  // already replaced by a newer load
+  }
+  *link = entry->next;
+  put_trace(entry);
+}
+
+static void release_trace(Server *server, TraceEntry *entry) {
+  pthread_mutex_lock(&server->trace_lock);
+  put_trace(entry);
+  pthread_mutex_unlock(&server->trace_lock);
+}
+
+static int same_file(const TraceEntry *entry, const struct stat *st) {
+  return entry->size == st->st_size &&
+         entry->mtime.tv_sec == st->st_mtim.tv_sec &&
+         entry->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+// Returns the resident copy of a trace, decoding it on first use or when the
+// file has changed since. The file is decoded outside trace_lock, so workers
+// asking for other traces are not held up; those asking for the same one
+// wait for it. The caller hands the entry back with release_trace().
+static TraceEntry *get_trace(Server *server, const char *trace_file) {
+  struct stat st;
+  if (stat(trace_file, &st) == -1) {
+    return NULL;
+  }
+
+  pthread_mutex_lock(&server->trace_lock);
+  TraceEntry *entry = server->traces;
+  while (entry != NULL && strcmp(entry->trace_file, trace_file) != 0) {
+    entry = entry->next;
+  }
+  if (entry != NULL && !same_file(entry, &st)) {
+    unlink_trace(server, entry);  // edited since: load it again
+    entry = NULL;
+  }
+
+  if (entry == NULL) {
+    entry = (TraceEntry *)malloc(sizeof(TraceEntry));
+    entry->trace_file = strdup(trace_file);
+    entry->size = st.st_size;
+    entry->mtime = st.st_mtim;
+    entry->trace = NULL;
+    entry->loading = 1;
+    entry->refs = 2;
+    entry->next = server->traces;
+    server->traces = entry;
+    pthread_mutex_unlock(&server->trace_lock);
+
+    Trace *trace = load_trace(trace_file);
+
+    pthread_mutex_lock(&server->trace_lock);
+    entry->trace = trace;
+    entry->loading = 0;
+    if (trace == NULL) {
+      unlink_trace(server, entry);  // let the next query try again
+    }
+    pthread_cond_broadcast(&server->trace_loaded);
+  } else {
+    entry->refs++;
+    while (entry->loading) {
+      pthread_cond_wait(&server->trace_loaded, &server->trace_lock);
+    }
+  }
+  pthread_mutex_unlock(&server->trace_lock);
+
+  if (entry->trace == NULL) {
+    release_trace(server, entry);
+    return NULL;
+  }
+  return entry;
+}
+
+static int result_bucket(Server *server, unsigned long trace_hash,
+                         int set_bits, int line_count, int block_bits) {
+  unsigned long key = trace_hash;
+  key = key * 31 + set_bits;
+  key = key * 31 + line_count;
+  key = key * 31 + block_bits;
+  return key % server->result_buckets;
+}
+
+static int same_query(const ResultEntry *entry, unsigned long trace_hash,
+                      const Query *query) {
+  return entry->trace_hash == trace_hash &&
+         entry->set_bits == query->set_bits &&
+         entry->line_count == query->line_count &&
+         entry->block_bits == query->block_bits;
+}
+
+// Looks up a cached result; fills `result` and returns 1 if found. A hit
+// moves to the front of its bucket, so eviction drops the least recently
+// used entries.
+static int find_result(Server *server, unsigned long trace_hash, Query *query,
+                       ResultEntry *result) {
+  int found = 0;
+  pthread_mutex_lock(&server->result_lock);
+  int bucket = result_bucket(server, trace_hash, query->set_bits,
+                             query->line_count, query->block_bits);
+  ResultEntry **link = &server->results[bucket];
+  for (; *link != NULL; link = &(*link)->next) {
+    ResultEntry *entry = *link;
+    if (same_query(entry, trace_hash, query)) {
+      *link = entry->next;
+      entry->next = server->results[bucket];
+      server->results[bucket] = entry;
+      *result = *entry;
+      found = 1;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&server->result_lock);
+  return found;
+}
+
+// Adds a result at the front of its bucket and evicts whatever falls past
+// results_per_bucket, which bounds the cache at
+// result_buckets * results_per_bucket entries.
+static void store_result(Server *server, ResultEntry *result) {
+  ResultEntry *entry = (ResultEntry *)malloc(sizeof(ResultEntry));
+  *entry = *result;
+  int bucket = result_bucket(server, result->trace_hash, result->set_bits,
+                             result->line_count, result->block_bits);
+  pthread_mutex_lock(&server->result_lock);
+  entry->next = server->results[bucket];
+  server->results[bucket] = entry;
+
+  ResultEntry **link = &entry->next;
+  for (int kept = 1; *link != NULL && kept < server->results_per_bucket;
+       kept++) {
+    link = &(*link)->next;
+  }
+  ResultEntry *evicted = *link;
+  *link = NULL;
+  pthread_mutex_unlock(&server->result_lock);
+
+  while (evicted != NULL) {
+    ResultEntry *next = evicted->next;
+    free(evicted);
+    evicted = next;
+  }
+}
+
+static void answer_query(Server *server, Query *query) {
+  // room for the trace path echoed back in an error
+  char line[MAX_QUERY_LINE + 64];
+  TraceEntry *entry = get_trace(server, query->trace_file);
+  if (entry == NULL) {
+    snprintf(line, sizeof(line), "%d error: cannot read trace %s\n",
+             query->seq, query->trace_file);
+    write_line(query->client, line);
+    return;
+  }
+  Trace *trace = entry->trace;
+
+  ResultEntry result;
+  int cached = find_result(server, trace->hash, query, &result);
+  if (!cached) {
+    Cache *cache =
+        make_cache(query->set_bits, query->line_count, query->block_bits);
+    CPU *cpu = make_cpu(cache, NULL);
+    replay_trace(cpu, trace);
+
+    result.trace_hash = trace->hash;
+    result.set_bits = query->set_bits;
+    result.line_count = query->line_count;
+    result.block_bits = query->block_bits;
+    result.hits = cpu->hits;
+    result.cold = cpu->cold;
+    result.conflict = cpu->conflict;
+    store_result(server, &result);
+
+    delete_cpu(cpu);
+    delete_cache(cache);
+  }
+  release_trace(server, entry);
+
+  int miss = result.cold + result.conflict;
+  float hit_rate = 0.0f;
+  if (result.hits + miss > 0) {
+    hit_rate = ((float)(result.hits)) / ((float)(result.hits + miss));
+  }
+  snprintf(line, sizeof(line),
+           "%d hits: %d misses: %d evictions: %d hrate: %f mrate: %f "
+           "cached: %d\n",
+           query->seq, result.hits, miss, result.conflict, hit_rate,
+           1.0f - hit_rate, cached);
+  write_line(query->client, line);
+}
+
+static void *worker_main(void *arg) {
+  Server *server = (Server *)arg;
+  while (1) {
+    Query *query = pop_query(server);
+    answer_query(server, query);
+    release_client(query->client);
+    free(query->trace_file);
+    free(query);
+  }
+  return NULL;
+}
+
+// Parses one query line. On failure writes the reason into `error`.
+static Query *parse_query(char *line, char *error, size_t error_size) {
+  char trace_file[MAX_QUERY_LINE];
+  char policy[16] = "lru";
+  int set_bits, line_count, block_bits;
+
+  int fields = sscanf(line, "%4095s %d %d %d %15s", trace_file, &set_bits,
+                      &line_count, &block_bits, policy);
+  if (fields < 4) {
+    snprintf(error, error_size,
+             "expected <trace_file> <set_bits> <lines> <block_bits> [policy]");
+    return NULL;
+  }
+  if (strcmp(policy, "lru") != 0) {
+    snprintf(error, error_size, "unsupported policy %s", policy);
+    return NULL;
+  }
+  if (set_bits < 0 || set_bits > 24 || block_bits < 0 || block_bits > 24 ||
+      line_count < 1 ||
+      ((long)line_count << (set_bits + block_bits)) > MAX_CACHE_BYTES) {
+    snprintf(error, error_size, "invalid cache geometry");
+    return NULL;
+  }
+
+  Query *query = (Query *)malloc(sizeof(Query));
+  query->trace_file = strdup(trace_file);
+  query->set_bits = set_bits;
+  query->line_count = line_count;
+  query->block_bits = block_bits;
+  return query;
+}
+
+// Reads queries off one connection and hands them to the worker pool.
+static void *client_main(void *arg) {
+  Client *client = (Client *)arg;
+  FILE *in = fdopen(dup(client->fd), "r");
+  char line[MAX_QUERY_LINE];
+  int seq = 0;
+
+  while (in != NULL && fgets(line, sizeof(line), in) != NULL) {
+    if (line[0] == '\n') continue;
+    seq++;
+
+    char error[128];
+    Query *query = parse_query(line, error, sizeof(error));
+    if (query == NULL) {
+      char answer[192];
+      snprintf(answer, sizeof(answer), "%d error: %s\n", seq, error);
+      write_line(client, answer);
+      continue;
+    }
+    query->client = client;
+    query->seq = seq;
+    push_query(client->server, query);
+  }
+
+  if (in != NULL) {
+    fclose(in);
+  }
+  release_client(client);
+  return NULL;
+}
+
+Server *make_server(const char *socket_path, int worker_count) {
+  struct sockaddr_un addr;
+  if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "socket path too long: %s\n", socket_path);
+    return NULL;
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1) {
+    perror("socket");
+    return NULL;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, socket_path);
+  unlink(socket_path);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+      listen(fd, 64) == -1) {
+    perror("bind/listen");
+    close(fd);
+    return NULL;
+  }
+
+  Server *server = (Server *)malloc(sizeof(Server));
+  server->listen_fd = fd;
+  server->worker_count = worker_count;
+  server->queue_head = NULL;
+  server->queue_tail = NULL;
+  pthread_mutex_init(&server->queue_lock, NULL);
+  pthread_cond_init(&server->queue_ready, NULL);
+  server->traces = NULL;
+  pthread_mutex_init(&server->trace_lock, NULL);
+  pthread_cond_init(&server->trace_loaded, NULL);
+  server->result_buckets = RESULT_BUCKETS;
+  server->results_per_bucket = RESULTS_PER_BUCKET;
+  server->results =
+      (ResultEntry **)calloc(server->result_buckets, sizeof(ResultEntry *));
+  pthread_mutex_init(&server->result_lock, NULL);
+
+  server->workers = (pthread_t *)malloc(sizeof(pthread_t) * worker_count);
+  for (int i = 0; i < worker_count; i++) {
+    pthread_create(&server->workers[i], NULL, worker_main, server);
+  }
+  return server;
+}
+
+void run_server(Server *server) {
+  // A client hanging up early must not kill the server mid-answer.
+  signal(SIGPIPE, SIG_IGN);
+
+  while (1) {
+    int fd = accept(server->listen_fd, NULL, NULL);
+    if (fd == -1) {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      perror("accept");
+      return;
+    }
+
+    Client *client = (Client *)malloc(sizeof(Client));
+    client->fd = fd;
+    client->refs = 1;
+    client->server = server;
+    pthread_mutex_init(&client->write_lock, NULL);
+
+    pthread_t reader;
+    if (pthread_create(&reader, NULL, client_main, client) != 0) {
+      close(fd);
+      free(client);
+      continue;
+    }
+    pthread_detach(reader);
+  }
+}
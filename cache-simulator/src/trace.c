@@ -0,0 +1,49 @@
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+static unsigned long hash_lines(const TraceLine *lines, int count) {
+  unsigned long hash = 14695981039346656037UL;
+  for (int i = 0; i < count; i++) {
+    unsigned long fields[3] = {(unsigned long)lines[i].operation,
+                               (unsigned long)lines[i].address,
+                               (unsigned long)lines[i].size};
+    for (int f = 0; f < 3; f++) {
+      hash ^= fields[f];
+      hash *= 1099511628211UL;
+    }
+  }
+  return hash;
+}
+
+Trace *load_trace(const char *address_trace_file) {
+  FILE *file = fopen(address_trace_file, "r");
+  if (file == NULL) {
+    return NULL;
+  }
+
+  Trace *trace = (Trace *)malloc(sizeof(Trace));
+  int capacity = 4096;
+  trace->lines = (TraceLine *)malloc(sizeof(TraceLine) * capacity);
+  trace->count = 0;
+
+  TraceLine line;
+  while (fscanf(file, "%c %x,%c\n", &line.operation, &line.address,
+                &line.size) != EOF) {
+    if (trace->count == capacity) {
+      capacity *= 2;
+      trace->lines =
+          (TraceLine *)realloc(trace->lines, sizeof(TraceLine) * capacity);
+    }
+    trace->lines[trace->count++] = line;
+  }
+  fclose(file);
+
+  trace->hash = hash_lines(trace->lines, trace->count);
+  return trace;
+}
+
+void delete_trace(Trace *trace) {
+  free(trace->lines);
+  free(trace);
+}
@@ -3,8 +3,18 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <string>
+#include <thread>
+#include <vector>
 #include "cache.h"
+#include "cache.hpp"
 #include "cpu.h"
+#include "profile.h"
+#include "server.h"
 
 // Include these definitions to test against solution:
 int soln_get_set(Cache *cache, address_type address);
@@ -205,3 +215,246 @@ TEST(ProjectTests, test_wc_trace) {
          "within the range of the expected result of 22088"
       << ". You were off by " << diff << ".";
 }
+
+TEST(ProjectTests, test_same_block_runs) {
+  // Runs of accesses inside one block take the fast path in run_cpu; the
+  // totals must match feeding every access through cache_access.
+  const char *trace = "test/runs.trace";
+  FILE *f = fopen(trace, "w");
+  ASSERT_NE(f, (FILE *)NULL) << "could not create " << trace;
+  unsigned int addresses[] = {0x100, 0x101, 0x107, 0x10f, 0x300, 0x301,
+                              0x100, 0x100, 0x500, 0x700, 0x900, 0x104};
+  int n = sizeof(addresses) / sizeof(addresses[0]);
+  for (int i = 0; i < n; i++) {
+    fprintf(f, "L %x,4\n", addresses[i]);
+  }
+  fclose(f);
+
+  Cache *expected_cache = make_cache(1, 2, 4);
+  int hits = 0, cold = 0, conflict = 0;
+  for (int i = 0; i < n; i++) {
+    TraceLine line = {'L', addresses[i], '4'};
+    AccessResult r = cache_access(expected_cache, &line);
+    hits += r == HIT;
+    cold += r == COLD_MISS;
+    conflict += r == CONFLICT_MISS;
+  }
+
+  Cache *cache = make_cache(1, 2, 4);
+  CPU *cpu = make_cpu(cache, trace);
+  ASSERT_NE(cpu, (CPU *)NULL) << "cpu is NULL";
+  run_cpu(cpu);
+  remove(trace);
+
+  ASSERT_EQ(n, cpu->address_count);
+  ASSERT_EQ(hits, cpu->hits);
+  ASSERT_EQ(cold, cpu->cold);
+  ASSERT_EQ(conflict, cpu->conflict);
+
+  delete_cpu(cpu);
+  delete_cache(cache);
+  delete_cache(expected_cache);
+}
+
+TEST(ProjectTests, test_replay_resident_trace) {
+  const char *trace_file = "test/replay.trace";
+  FILE *f = fopen(trace_file, "w");
+  ASSERT_NE(f, (FILE *)NULL) << "could not create " << trace_file;
+  for (int i = 0; i < 2000; i++) {
+    fprintf(f, "L %x,4\n", (i * 2654435761u) % 0x10000);
+  }
+  fclose(f);
+
+  Trace *trace = load_trace(trace_file);
+  ASSERT_NE(trace, (Trace *)NULL) << "trace is NULL";
+  ASSERT_EQ(2000, trace->count);
+
+  Cache *file_cache = make_cache(2, 2, 4);
+  CPU *file_cpu = make_cpu(file_cache, trace_file);
+  run_cpu(file_cpu);
+
+  Cache *cache = make_cache(2, 2, 4);
+  CPU *cpu = make_cpu(cache, NULL);
+  replay_trace(cpu, trace);
+  remove(trace_file);
+
+  ASSERT_EQ(file_cpu->hits, cpu->hits);
+  ASSERT_EQ(file_cpu->cold, cpu->cold);
+  ASSERT_EQ(file_cpu->conflict, cpu->conflict);
+
+  delete_cpu(cpu);
+  delete_cache(cache);
+  delete_cpu(file_cpu);
+  delete_cache(file_cache);
+  delete_trace(trace);
+}
+
+TEST(ProjectTests, test_profile_reuse_distance) {
+  // Blocks A B C A B B D A with 16-byte blocks.
+  unsigned int addresses[] = {0x00, 0x10, 0x20, 0x04, 0x18, 0x1c, 0x30, 0x08};
+  Profile *profile = make_profile(4, 20, 4);
+  for (int i = 0; i < 8; i++) {
+    profile_access(profile, addresses[i], i < 3 || i == 6 ? COLD_MISS : HIT);
+  }
+
+  ASSERT_EQ(8, profile->accesses);
+  ASSERT_EQ(4, profile->block_count);
+  ASSERT_EQ(4, profile->cold) << "A, B, C and D are first touches";
+  ASSERT_EQ(1, profile->histogram[0]) << "B B is a reuse at distance 0";
+  ASSERT_EQ(3, profile->histogram[2]) << "A, B and A are reused at distance 2";
+
+  ASSERT_EQ(1, profile->window_count);
+  ASSERT_EQ(3, profile->working_set[0]) << "first window touches A B C";
+  ASSERT_EQ(3, profile->window_blocks) << "second window touches B D A";
+
+  ASSERT_EQ(1, profile->region_count);
+  delete_profile(profile);
+}
+
+TEST(ProjectTests, test_cache_access_batch) {
+  std::vector<address_type> addresses;
+  for (int i = 0; i < 5000; i++) {
+    addresses.push_back(i % 7 == 0 ? (i * 2654435761u) % 0x8000 : i * 3);
+  }
+
+  Cache *expected_cache = make_cache(3, 2, 5);
+  std::vector<AccessResult> expected;
+  for (address_type address : addresses) {
+    TraceLine line = {'L', address, '4'};
+    expected.push_back(cache_access(expected_cache, &line));
+  }
+  delete_cache(expected_cache);
+
+  Cache *cache = make_cache(3, 2, 5);
+  std::vector<AccessResult> results(addresses.size());
+  AccessStats stats = {0, 0, 0};
+  cache_access_batch(cache, addresses.data(), NULL, addresses.size(),
+                     results.data(), &stats);
+  delete_cache(cache);
+
+  ASSERT_TRUE(results == expected) << "batch results differ from cache_access";
+  ASSERT_EQ((long)addresses.size(), stats.hits + stats.cold + stats.conflict);
+}
+
+TEST(ProjectTests, test_cache_sim_threads) {
+  // Independent caches share no state and can run on separate threads.
+  std::vector<address_type> addresses;
+  for (int i = 0; i < 20000; i++) {
+    addresses.push_back((i * 40503u) % 0x20000);
+  }
+
+  cachesim::CacheSim reference(2, 4, 6);
+  AccessStats expected = reference.access(addresses);
+
+  std::vector<AccessStats> stats(4);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([&addresses, &stats, t]() {
+      cachesim::CacheSim sim(2, 4, 6);
+      for (size_t i = 0; i < addresses.size(); i += 1000) {
+        sim.access(addresses.data() + i, 1000);
+      }
+      stats[t] = sim.stats();
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  for (int t = 0; t < 4; t++) {
+    ASSERT_EQ(expected.hits, stats[t].hits);
+    ASSERT_EQ(expected.cold, stats[t].cold);
+    ASSERT_EQ(expected.conflict, stats[t].conflict);
+  }
+}
+
+static void write_trace(const char *trace_file, int count, unsigned int step) {
+  FILE *f = fopen(trace_file, "w");
+  for (int i = 0; i < count; i++) {
+    fprintf(f, "L %x,4\n", (i * step) % 0x10000);
+  }
+  fclose(f);
+}
+
+// Sends one query and returns its answer line.
+static std::string ask(int fd, const char *query) {
+  write(fd, query, strlen(query));
+  std::string line;
+  char c;
+  while (read(fd, &c, 1) == 1 && c != '\n') {
+    line += c;
+  }
+  return line;
+}
+
+TEST(ProjectTests, test_server_reloads_changed_trace) {
+  const char *socket_path = "/tmp/cache_test.sock";
+  const char *trace_file = "test/server.trace";
+  write_trace(trace_file, 1000, 2654435761u);
+
+  Server *server = make_server(socket_path, 2);
+  ASSERT_NE(server, (Server *)NULL);
+  std::thread([server]() { run_server(server); }).detach();
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, socket_path);
+  ASSERT_EQ(0, connect(fd, (struct sockaddr *)&addr, sizeof(addr)));
+
+  std::string first = ask(fd, "test/server.trace 2 2 4\n");
+  ASSERT_NE(std::string::npos, first.find("cached: 0")) << first;
+  std::string again = ask(fd, "test/server.trace 2 2 4\n");
+  ASSERT_NE(std::string::npos, again.find("cached: 1")) << again;
+  ASSERT_EQ(first.substr(first.find(' '), first.find("cached") - first.find(' ')),
+            again.substr(again.find(' '), again.find("cached") - again.find(' ')));
+
+  // A different file under the same path is decoded again, not served stale.
+  write_trace(trace_file, 3000, 7u);
+  Trace *trace = load_trace(trace_file);
+  Cache *cache = make_cache(2, 2, 4);
+  CPU *cpu = make_cpu(cache, NULL);
+  replay_trace(cpu, trace);
+  std::string expected = "hits: " + std::to_string(cpu->hits) + " ";
+  delete_cpu(cpu);
+  delete_cache(cache);
+  delete_trace(trace);
+
+  std::string edited = ask(fd, "test/server.trace 2 2 4\n");
+  ASSERT_NE(std::string::npos, edited.find("cached: 0")) << edited;
+  ASSERT_NE(std::string::npos, edited.find(expected)) << edited;
+
+  remove(trace_file);
+  std::string missing = ask(fd, "test/server.trace 2 2 4\n");
+  ASSERT_NE(std::string::npos, missing.find("error")) << missing;
+
+  close(fd);
+  unlink(socket_path);
+}
+
+TEST(ProjectTests, test_server_long_trace_path) {
+  const char *socket_path = "/tmp/cache_test_long.sock";
+  Server *server = make_server(socket_path, 1);
+  ASSERT_NE(server, (Server *)NULL);
+  std::thread([server]() { run_server(server); }).detach();
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, socket_path);
+  ASSERT_EQ(0, connect(fd, (struct sockaddr *)&addr, sizeof(addr)));
+
+  // The error echoes the whole path and still ends the line, so the next
+  // answer is not glued onto it.
+  std::string path = "test/" + std::string(1000, 'x') + ".trace";
+  std::string query = path + " 2 2 4\n";
+  std::string missing = ask(fd, query.c_str());
+  ASSERT_EQ("1 error: cannot read trace " + path, missing);
+  std::string again = ask(fd, query.c_str());
+  ASSERT_EQ("2 error: cannot read trace " + path, again);
+
+  close(fd);
+  unlink(socket_path);
+}
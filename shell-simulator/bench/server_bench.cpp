@@ -0,0 +1,140 @@
+#include <server.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+/**
+ * @brief Measures the tsh daemon: command lines per second from concurrent
+ * clients, compared with spawning `tsh -c` for every line, and bulk output
+ * throughput through the framed socket.
+ *
+ * Usage: server_bench [tsh_path] [requests] [clients] [megabytes]
+ *
+ * Each client is a separate process running its share of the requests one
+ * after another, as a job runner would.
+ */
+
+extern char **environ;
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static pid_t spawn(char **argv) {
+  pid_t pid;
+  int err = posix_spawn(&pid, argv[0], nullptr, nullptr, argv, environ);
+  if (err != 0) {
+    fprintf(stderr, "posix_spawn %s: %s\n", argv[0], strerror(err));
+    exit(1);
+  }
+  return pid;
+}
+
+// Sends `line` and waits for its exit frame; returns the bytes of output.
+static long run_request(int fd, FrameReader &reader, uint32_t id,
+                        const std::string &line) {
+  if (!write_frame(fd, FRAME_RUN, id, line.data(), line.size())) {
+    exit(1);
+  }
+  FrameHeader header;
+  std::string payload;
+  long bytes = 0;
+  while (read_frame(reader, header, payload)) {
+    if (header.type == FRAME_EXIT) return bytes;
+    bytes += payload.size();
+  }
+  fprintf(stderr, "daemon went away\n");
+  exit(1);
+}
+
+static void daemon_client(const char *socket_path, int requests) {
+  int fd = connect_server(socket_path);
+  if (fd == -1) {
+    perror(socket_path);
+    exit(1);
+  }
+  FrameReader reader(fd);
+  for (int i = 0; i < requests; i++) run_request(fd, reader, i, "true");
+  close(fd);
+}
+
+static void exec_client(const char *tsh, int requests) {
+  char arg1[] = "-c";
+  char arg2[] = "true";
+  char *argv[] = {(char *)tsh, arg1, arg2, nullptr};
+  for (int i = 0; i < requests; i++) waitpid(spawn(argv), nullptr, 0);
+}
+
+// Runs `clients` processes of requests/clients lines each; returns lines/sec.
+static double run_clients(const char *tsh, const char *socket_path,
+                          int requests, int clients) {
+  std::vector<pid_t> pids;
+  double start = now();
+  for (int c = 0; c < clients; c++) {
+    int share = requests / clients + (c < requests % clients);
+    pid_t pid = fork();
+    if (pid == 0) {
+      if (socket_path != nullptr) {
+        daemon_client(socket_path, share);
+      } else {
+        exec_client(tsh, share);
+      }
+      _exit(0);
+    }
+    pids.push_back(pid);
+  }
+  for (pid_t pid : pids) waitpid(pid, nullptr, 0);
+  return requests / (now() - start);
+}
+
+int main(int argc, char **argv) {
+  const char *tsh = argc > 1 ? argv[1] : "./tsh_app";
+  int requests = argc > 2 ? atoi(argv[2]) : 2000;
+  int clients = argc > 3 ? atoi(argv[3]) : 4;
+  long megabytes = argc > 4 ? atol(argv[4]) : 256;
+
+  std::string socket_path =
+      "/tmp/server_bench." + std::to_string(getpid()) + ".sock";
+  char arg1[] = "--server";
+  char *daemon_argv[] = {(char *)tsh, arg1, &socket_path[0], nullptr};
+  pid_t daemon = spawn(daemon_argv);
+  int fd = -1;
+  for (int tries = 0; tries < 200 && fd == -1; tries++) {
+    usleep(10000);
+    fd = connect_server(socket_path.c_str());
+  }
+  if (fd == -1) {
+    fprintf(stderr, "daemon did not come up on %s\n", socket_path.c_str());
+    kill(daemon, SIGTERM);
+    return 1;
+  }
+
+  printf("%d command lines of `true` from %d clients\n", requests, clients);
+  printf("%-14s %10.0f lines/sec\n", "daemon",
+         run_clients(tsh, socket_path.c_str(), requests, clients));
+  printf("%-14s %10.0f lines/sec\n", "tsh -c each",
+         run_clients(tsh, nullptr, requests, clients));
+
+  FrameReader reader(fd);
+  std::string line =
+      "head -c " + std::to_string(megabytes << 20) + " /dev/zero";
+  double start = now();
+  long bytes = run_request(fd, reader, 0, line);
+  printf("%-14s %10.2f GB/s   (%ld MB of output)\n", "output",
+         bytes / (now() - start) / 1e9, bytes >> 20);
+
+  close(fd);
+  kill(daemon, SIGTERM);
+  waitpid(daemon, nullptr, 0);
+  unlink(socket_path.c_str());
+  return 0;
+}
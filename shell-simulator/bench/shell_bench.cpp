@@ -0,0 +1,246 @@
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/wait.h>
+#include <time.h>
+#include <tsh.h>
+#include <unistd.h>
+#include <vector>
+
+/**
+ * @brief The shell's launch-path benchmark suite: startup time, single
+ * command spawn latency, N-stage pipeline setup and bulk pipe throughput,
+ * checked against a baseline file.
+ *
+ * Usage: shell_bench [-t tsh] [-n runs] [-s stages] [-m megabytes]
+ *                    [-b baseline] [-w] [-r tolerance_pct]
+ *
+ * Spawn, pipeline and throughput runs go through parse_input() and
+ * run_commands() in this process, so they measure the shell's own
+ * fork/pipe/dup2 path. Startup spawns the tsh binary with `-c true`.
+ *
+ * With -b, results are compared to the baseline file and the exit status is
+ * 1 if any metric is worse by more than the tolerance (default 25%). -w
+ * writes the results to the baseline file instead; a missing baseline file
+ * is written the same way.
+ */
+
+extern char **environ;
+
+/**
+ * @brief One line of the report and of the baseline file.
+ */
+struct Metric {
+  std::string name;
+  double value;
+  const char *unit;
+  bool higher_is_better;
+};
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double percentile(std::vector<double> &samples, int pct) {
+  std::sort(samples.begin(), samples.end());
+  size_t n = samples.size();
+  return samples[std::min(n - 1, n * pct / 100)];
+}
+
+static void add_latency(std::vector<Metric> &metrics, const std::string &name,
+                        std::vector<double> &samples) {
+  metrics.push_back({name + "_p50", percentile(samples, 50) * 1e6, "us", false});
+  metrics.push_back({name + "_p99", percentile(samples, 99) * 1e6, "us", false});
+}
+
+// Parses and runs one command line the way the shell does; returns seconds.
+static double run_line(const std::string &text) {
+  std::vector<char> line(text.begin(), text.end());
+  line.push_back('\0');
+  list<Process *> process_list;
+  double start = now();
+  parse_input(line.data(), process_list);
+  run_commands(process_list);
+  double elapsed = now() - start;
+  cleanup(process_list, nullptr);
+  return elapsed;
+}
+
+static double startup_latency(const char *tsh) {
+  char arg1[] = "-c";
+  char arg2[] = "true";
+  char *argv[] = {(char *)tsh, arg1, arg2, nullptr};
+  double start = now();
+  pid_t pid;
+  int err = posix_spawn(&pid, tsh, nullptr, nullptr, argv, environ);
+  if (err != 0) {
+    fprintf(stderr, "posix_spawn %s: %s\n", tsh, strerror(err));
+    exit(1);
+  }
+  waitpid(pid, nullptr, 0);
+  return now() - start;
+}
+
+// Producer and consumer ends of the throughput pipeline.
+static int produce(long bytes) {
+  static char buffer[1 << 20];
+  memset(buffer, 'x', sizeof(buffer));
+  while (bytes > 0) {
+    ssize_t n = write(STDOUT_FILENO, buffer,
+                      std::min<long>(bytes, sizeof(buffer)));
+    if (n == -1) {
+      if (errno == EINTR) continue;
+      return 1;
+    }
+    bytes -= n;
+  }
+  return 0;
+}
+
+static int consume() {
+  static char buffer[1 << 20];
+  ssize_t n;
+  while ((n = read(STDIN_FILENO, buffer, sizeof(buffer))) != 0) {
+    if (n == -1 && errno != EINTR) return 1;
+  }
+  return 0;
+}
+
+static std::vector<Metric> run_suite(const char *tsh, const char *self,
+                                     int runs, int stages, long megabytes) {
+  std::vector<Metric> metrics;
+  std::vector<double> samples;
+
+  for (int i = 0; i < runs; i++) samples.push_back(startup_latency(tsh));
+  add_latency(metrics, "startup", samples);
+
+  samples.clear();
+  for (int i = 0; i < runs; i++) samples.push_back(run_line("/bin/true"));
+  add_latency(metrics, "spawn", samples);
+
+  std::string pipeline = "/bin/true";
+  for (int i = 1; i < stages; i++) pipeline += " | /bin/true";
+  samples.clear();
+  for (int i = 0; i < runs; i++) samples.push_back(run_line(pipeline));
+  add_latency(metrics, "pipeline" + std::to_string(stages), samples);
+
+  long bytes = megabytes << 20;
+  std::string transfer = std::string(self) + " --produce " +
+                         std::to_string(bytes) + " | " + self + " --consume";
+  double elapsed = run_line(transfer);
+  metrics.push_back({"pipe_throughput", bytes / elapsed / 1e9, "GB/s", true});
+  return metrics;
+}
+
+static bool read_baseline(const char *path, std::vector<Metric> &baseline) {
+  FILE *in = fopen(path, "r");
+  if (in == nullptr) return false;
+  char name[64];
+  double value;
+  while (fscanf(in, "%63s %lf%*[^\n]", name, &value) == 2) {
+    baseline.push_back({name, value, "", false});
+  }
+  fclose(in);
+  return true;
+}
+
+static void write_baseline(const char *path,
+                           const std::vector<Metric> &metrics) {
+  FILE *out = fopen(path, "w");
+  if (out == nullptr) {
+    perror(path);
+    exit(1);
+  }
+  for (const Metric &metric : metrics) {
+    fprintf(out, "%s %.3f %s\n", metric.name.c_str(), metric.value,
+            metric.unit);
+  }
+  fclose(out);
+  printf("baseline written to %s\n", path);
+}
+
+int main(int argc, char **argv) {
+  if (argc > 2 && strcmp(argv[1], "--produce") == 0) {
+    return produce(atol(argv[2]));
+  }
+  if (argc > 1 && strcmp(argv[1], "--consume") == 0) {
+    return consume();
+  }
+
+  const char *tsh = "./tsh_app";
+  const char *baseline_path = nullptr;
+  int runs = 200, stages = 8;
+  long megabytes = 1024;
+  double tolerance = 25;
+  bool write = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "t:n:s:m:b:wr:")) != -1) {
+    switch (opt) {
+      case 't': tsh = optarg; break;
+      case 'n': runs = std::max(1, atoi(optarg)); break;
+      case 's': stages = std::max(1, atoi(optarg)); break;
+      case 'm': megabytes = std::max(1L, atol(optarg)); break;
+      case 'b': baseline_path = optarg; break;
+      case 'w': write = true; break;
+      case 'r': tolerance = atof(optarg); break;
+      default:
+        fprintf(stderr,
+                "usage: %s [-t tsh] [-n runs] [-s stages] [-m megabytes] "
+                "[-b baseline] [-w] [-r tolerance_pct]\n",
+                argv[0]);
+        return 2;
+    }
+  }
+
+  char self[PATH_MAX];
+  ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+  if (len == -1) {
+    perror("readlink");
+    return 1;
+  }
+  self[len] = '\0';
+
+  std::vector<Metric> metrics = run_suite(tsh, self, runs, stages, megabytes);
+
+  std::vector<Metric> baseline;
+  bool compare = baseline_path != nullptr && !write &&
+                 read_baseline(baseline_path, baseline);
+  int regressions = 0;
+  printf("%-20s %14s %13s %9s   (%d runs, %ld MB piped)\n", "metric", "value",
+         "baseline", "change", runs, megabytes);
+  for (const Metric &metric : metrics) {
+    printf("%-20s %9.2f %-4s", metric.name.c_str(), metric.value, metric.unit);
+    auto base = std::find_if(
+        baseline.begin(), baseline.end(),
+        [&](const Metric &b) { return b.name == metric.name; });
+    if (!compare || base == baseline.end() || base->value <= 0) {
+      printf("\n");
+      continue;
+    }
+    double change = (metric.value - base->value) / base->value * 100;
+    bool worse = metric.higher_is_better ? change < -tolerance
+                                         : change > tolerance;
+    regressions += worse;
+    printf(" %12.2f %+8.1f%%%s\n", base->value, change,
+           worse ? "   REGRESSION" : "");
+  }
+
+  if (baseline_path != nullptr && !compare) {
+    write_baseline(baseline_path, metrics);
+  }
+  if (regressions > 0) {
+    printf("%d metric(s) regressed by more than %.0f%%\n", regressions,
+           tolerance);
+    return 1;
+  }
+  return 0;
+}
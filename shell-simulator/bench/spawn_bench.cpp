@@ -0,0 +1,89 @@
+#include <algorithm>
+#include <launch.h>
+#include <zygote.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+/**
+ * @brief Launches /bin/true repeatedly through each spawn backend, as a
+ * script loop of short commands would, and reports commands per second and
+ * the p50/p99 latency from launch to exit.
+ *
+ * Usage: spawn_bench [count] [resident_mb]
+ *
+ * resident_mb grows the benchmark's own address space first (touching every
+ * page) to show how fork() cost scales with the size of the parent. The
+ * zygote backend is not: its children are forked from a helper started
+ * while the process was small, off the critical path.
+ */
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+struct BackendResult {
+  double rate;  // commands per second
+  double p50;   // launch to exit, seconds
+  double p99;
+};
+
+static BackendResult run_backend(SpawnBackend backend, int count) {
+  set_spawn_backend(backend);
+  char arg0[] = "true";
+  char *argv[] = {arg0, nullptr};
+
+  LaunchSpec spec;
+  spec.path = "/bin/true";
+  spec.argv = argv;
+
+  // One untimed launch starts the zygote.
+  waitpid(launch(spec), nullptr, 0);
+
+  std::vector<double> samples;
+  double start = now();
+  for (int i = 0; i < count; i++) {
+    double launched = now();
+    pid_t pid = launch(spec);
+    if (pid < 0) {
+      exit(1);
+    }
+    waitpid(pid, nullptr, 0);
+    samples.push_back(now() - launched);
+  }
+  BackendResult result;
+  result.rate = count / (now() - start);
+  std::sort(samples.begin(), samples.end());
+  result.p50 = samples[count / 2];
+  result.p99 = samples[std::min(count - 1, count * 99 / 100)];
+  return result;
+}
+
+int main(int argc, char **argv) {
+  int count = argc > 1 ? atoi(argv[1]) : 2000;
+  long resident_mb = argc > 2 ? atol(argv[2]) : 0;
+
+  // As tsh does at startup, fork the zygote before the process grows.
+  zygote().start();
+  if (resident_mb > 0) {
+    size_t bytes = resident_mb << 20;
+    char *ballast = (char *)malloc(bytes);
+    memset(ballast, 1, bytes);
+  }
+
+  printf("%-12s %12s %10s %10s   (%d launches, %ld MB resident)\n",
+         "backend", "cmds/sec", "p50 us", "p99 us", count, resident_mb);
+  SpawnBackend backends[] = {SPAWN_FORK, SPAWN_POSIX, SPAWN_ZYGOTE};
+  for (SpawnBackend backend : backends) {
+    BackendResult result = run_backend(backend, count);
+    printf("%-12s %12.0f %10.1f %10.1f\n", spawn_backend_name(backend),
+           result.rate, result.p50 * 1e6, result.p99 * 1e6);
+  }
+  return 0;
+}
@@ -0,0 +1,134 @@
+#include <algorithm>
+#include <fcntl.h>
+#include <limits.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+/**
+ * @brief Measures how long tsh takes from being spawned to exec'ing the first
+ * command of a `-c` line and of a script, and how fast it runs a large
+ * generated script.
+ *
+ * Usage: startup_bench [tsh_path] [runs] [script_lines]
+ *
+ * The first command is this benchmark itself in probe mode: it writes its
+ * CLOCK_MONOTONIC start time to stdout, which is a pipe back to us.
+ */
+
+extern char **environ;
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static pid_t spawn(char **argv, int stdout_fd) {
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  if (stdout_fd >= 0) {
+    posix_spawn_file_actions_adddup2(&actions, stdout_fd, STDOUT_FILENO);
+  }
+  pid_t pid;
+  int err = posix_spawn(&pid, argv[0], &actions, nullptr, argv, environ);
+  posix_spawn_file_actions_destroy(&actions);
+  if (err != 0) {
+    fprintf(stderr, "posix_spawn %s: %s\n", argv[0], strerror(err));
+    exit(1);
+  }
+  return pid;
+}
+
+// Spawns tsh with `args` and returns the seconds until the probe ran.
+static double first_exec_latency(std::vector<std::string> args) {
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC) == -1) {
+    perror("pipe2");
+    exit(1);
+  }
+  std::vector<char *> argv;
+  for (std::string &arg : args) argv.push_back(&arg[0]);
+  argv.push_back(nullptr);
+
+  double start = now();
+  pid_t pid = spawn(argv.data(), fds[1]);
+  close(fds[1]);
+
+  double probe = 0;
+  FILE *in = fdopen(fds[0], "r");
+  if (fscanf(in, "%lf", &probe) != 1) {
+    fprintf(stderr, "probe did not report\n");
+    exit(1);
+  }
+  fclose(in);
+  waitpid(pid, nullptr, 0);
+  return probe - start;
+}
+
+static void report(const char *mode, std::vector<double> &samples) {
+  std::sort(samples.begin(), samples.end());
+  size_t n = samples.size();
+  printf("%-10s p50 %8.1f us   p99 %8.1f us\n", mode, samples[n / 2] * 1e6,
+         samples[std::min(n - 1, n * 99 / 100)] * 1e6);
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1 && strcmp(argv[1], "--probe") == 0) {
+    printf("%.9f\n", now());
+    return 0;
+  }
+
+  std::string tsh = argc > 1 ? argv[1] : "./tsh_app";
+  int runs = argc > 2 ? atoi(argv[2]) : 200;
+  int script_lines = argc > 3 ? atoi(argv[3]) : 100000;
+
+  char self[PATH_MAX];
+  ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+  if (len == -1) {
+    perror("readlink");
+    return 1;
+  }
+  self[len] = '\0';
+  std::string probe = std::string(self) + " --probe";
+
+  char script[] = "/tmp/startup_bench.XXXXXX";
+  int fd = mkstemp(script);
+  FILE *out = fdopen(fd, "w");
+  fprintf(out, "#!%s\n%s\n", tsh.c_str(), probe.c_str());
+  fclose(out);
+
+  std::vector<double> c_mode, script_mode;
+  for (int i = 0; i < runs; i++) {
+    c_mode.push_back(first_exec_latency({tsh, "-c", probe}));
+    script_mode.push_back(first_exec_latency({tsh, script}));
+  }
+  printf("startup to first exec (%d runs)\n", runs);
+  report("-c", c_mode);
+  report("script", script_mode);
+
+  // A large generated script of builtins measures per-line overhead.
+  out = fopen(script, "w");
+  for (int i = 0; i < script_lines; i++) {
+    fprintf(out, "true arg%d ; echo line %d\n", i, i);
+  }
+  fclose(out);
+  std::vector<std::string> args = {tsh, script};
+  char *script_argv[] = {&args[0][0], &args[1][0], nullptr};
+  int null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+  double start = now();
+  waitpid(spawn(script_argv, null_fd), nullptr, 0);
+  double elapsed = now() - start;
+  printf("script of %d lines: %.3f s (%.0f lines/sec)\n", script_lines,
+         elapsed, script_lines / elapsed);
+
+  close(null_fd);
+  unlink(script);
+  return 0;
+}
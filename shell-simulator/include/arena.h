@@ -0,0 +1,52 @@
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stddef.h>
+#include <new>
+#include <utility>
+
+/**
+ * @brief Bump allocator for everything built while handling one input line.
+ *
+ * Allocations are carved out of a chain of blocks and are never freed one by
+ * one: reset() rewinds every block at once so the next line reuses the same
+ * memory. Blocks are only added when a line needs more than the arena has
+ * seen before, so a long script runs in flat memory.
+ */
+class Arena {
+ public:
+  explicit Arena(size_t block_size = 4096);
+  ~Arena();
+
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  void *alloc(size_t size, size_t align = alignof(max_align_t));
+
+  /**
+   * @brief Constructs a T inside the arena. Its destructor is not run by
+   * reset(); callers that need it call it explicitly.
+   */
+  template <typename T, typename... Args>
+  T *make(Args &&...args) {
+    return new (alloc(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+  }
+
+  void reset();
+
+ private:
+  struct Block {
+    Block *next;
+    size_t size;
+    size_t used;
+    char *data() { return reinterpret_cast<char *>(this + 1); }
+  };
+
+  Block *new_block(size_t size);
+
+  Block *head;
+  Block *current;
+  size_t block_size;
+};
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef _BUILTINS_H
+#define _BUILTINS_H
+
+#include <stddef.h>
+
+/**
+ * @brief A shell builtin: takes the command's nullptr-terminated argv and
+ * returns its exit status.
+ */
+typedef int (*BuiltinFn)(char **argv);
+
+struct Builtin {
+  const char *name;
+  BuiltinFn run;
+  bool (*accepts)(char **argv);  // nullptr, or whether run handles argv;
+                                 // otherwise the external command does
+  bool forks = false;  // runs in a child even on its own: it may block on
+                       // its input, and only a child can be interrupted
+  int pipe_size = 0;   // if not 0, a pipe the shell creates for its stdout
+                       // is grown to this many bytes
+};
+
+const Builtin *find_builtin(char **argv);
+int &last_status();
+bool &exit_requested();
+bool &pipefail();
+bool is_assignment(const char *word);
+const char *get_variable(const char *name, size_t length);
+void set_variable(const char *name, size_t length, const char *value);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef _GLOB_CACHE_H
+#define _GLOB_CACHE_H
+
+#include <sys/types.h>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Pathname expansion: `*`, `?` and `[...]` within one path component
+ * and `**` for any number of directories (bash's globstar).
+ *
+ * Directories are read with raw getdents64() into one buffer each, and the
+ * names are matched where they lie in it. Listings are keyed by the
+ * directory's device and inode, so whatever path or working directory leads
+ * to it, it is read once. Listings and the matches of each pattern are kept
+ * until forget(), which run_commands() calls after every pipeline it runs
+ * (a command may cd, or create and remove files) and cleanup() after every
+ * line: the words of one command that share a large directory read it once,
+ * and a repeated pattern is matched once.
+ *
+ * Matches are sorted bytewise. As in sh, a name starting with '.' is only
+ * matched by a pattern component that starts with '.', and a pattern
+ * without matches is left as it is.
+ */
+class GlobCache {
+ public:
+  void expand(const char *pattern, std::vector<std::string> &words);
+  void forget();
+
+ private:
+  struct Listing {
+    std::vector<char> buffer;            // the getdents64() records
+    std::vector<unsigned int> names;     // offsets of d_name in buffer
+    std::vector<unsigned char> types;    // their d_type, same order
+  };
+
+  const Listing &list(const std::string &dir);
+  bool is_directory(const std::string &prefix, const Listing &listing,
+                    size_t i);
+  void walk(const std::vector<std::string> &components, size_t index,
+            const std::string &prefix, std::vector<std::string> &matches);
+
+  std::map<std::pair<dev_t, ino_t>, Listing> listings;
+  std::unordered_map<std::string, std::vector<std::string>> results;
+};
+
+GlobCache &glob_cache();
+bool has_glob(const char *word);
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef _JOBS_H
+#define _JOBS_H
+
+#include <signal.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <time.h>
+#include <list>
+#include <string>
+#include <vector>
+
+#include <stats.h>
+
+enum JobState { JOB_RUNNING, JOB_STOPPED, JOB_DONE };
+
+/**
+ * @brief One pipeline started by the shell, in the foreground or with '&'.
+ */
+struct Job {
+  int id;                   // the n in %n
+  bool grouped;             // gets its own process group
+  pid_t pgid;               // that process group, once the first stage runs
+  std::vector<pid_t> pids;  // every process of the pipeline
+  std::vector<ProcessStats> stats;  // one per stage, in order; pid -1 for
+                                    // a stage that could not be started
+  int live;                 // processes not reaped yet
+  pid_t last_pid;           // last stage, whose status is the job's; -1 if
+                            // it could not be started
+  int status;               // exit status in `$?` form
+  JobState state;
+  bool background;
+  bool timed;               // report stats when done (the `time` prefix)
+  struct timespec deadline; // CLOCK_MONOTONIC; tv_sec 0 if none
+  int timeout_signal;       // last signal sent for the deadline, or 0
+  std::string command;
+};
+
+/**
+ * @brief The shell's jobs, kept up to date by a SIGCHLD handler.
+ *
+ * The handler reaps every child that changes state (exited, killed, stopped
+ * or continued) with wait4() into a fixed ring of (pid, status, rusage, time)
+ * events, so background jobs
+ * never linger as zombies. The ring is drained into the jobs, outside the
+ * handler, whenever the shell looks at them.
+ *
+ * wait_for() supervises a job with epoll instead: a pidfd per live process
+ * reaps each one with waitid() the moment it exits, whatever the launch
+ * order; a signalfd for SIGCHLD catches stops and other children; a timerfd
+ * enforces the nearest deadline of any job. A job run with TSH_TIMEOUT set
+ * gets SIGTERM when it runs out of time, SIGKILL a second later, and status
+ * 124. The shell also wakes for deadlines while it waits for input.
+ *
+ * Once enable_job_control() has been called (interactive shells on a
+ * terminal), each pipeline gets its own process group and the foreground one
+ * owns the terminal. Jobs created with `grouped` false (the members of a
+ * parallel run) stay in the shell's group instead.
+ */
+class JobTable {
+ public:
+  JobTable();
+
+  void enable_job_control();
+  bool job_control() const { return control; }
+
+  Job *create(bool background, bool grouped = true);
+  void add_process(Job *job, pid_t pid, const char *command,
+                   const struct timespec &start);
+  void add_failure(Job *job, const char *command, int status);
+  void finish(Job *job);
+  void wait_for(Job *job);
+  void resume(Job *job, bool foreground);
+  void wait_all();
+
+  Job *find(int id);
+  Job *find_pid(pid_t pid);
+  Job *current();
+  void update();
+  const struct timespec *time_left(struct timespec &left);
+  void notify(FILE *out);
+  void print(FILE *out);
+  void remove(Job *job);
+  bool empty() const { return jobs.empty(); }
+
+ private:
+  void apply(pid_t pid, int status, const struct rusage &usage,
+             const struct timespec &end);
+  void expire(Job *job);
+  const struct timespec *nearest_deadline() const;
+  bool supervise(Job *job, const sigset_t &chld);
+
+  std::list<Job> jobs;
+  bool control;
+  pid_t shell_pgid;
+};
+
+JobTable &job_table();
+Job *parse_job_spec(const char *builtin, const char *spec);
+int jobs_builtin(char **argv);
+int fg_builtin(char **argv);
+int bg_builtin(char **argv);
+int wait_builtin(char **argv);
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef _LAUNCH_H
+#define _LAUNCH_H
+
+#include <sys/types.h>
+#include <vector>
+
+/**
+ * @brief How child processes are started.
+ *
+ * SPAWN_FORK copies the shell with fork() and wires fds in the child.
+ * SPAWN_POSIX uses posix_spawn(), which glibc implements with
+ * clone(CLONE_VM | CLONE_VFORK): the child borrows the shell's address space
+ * until it execs, so launch cost no longer grows with the shell's size.
+ * SPAWN_ZYGOTE hands the command to a child pre-forked by a helper process
+ * (see Zygote), so only the exec is left on the critical path.
+ */
+enum SpawnBackend { SPAWN_FORK, SPAWN_POSIX, SPAWN_ZYGOTE };
+
+#ifndef TSH_DEFAULT_SPAWN
+#define TSH_DEFAULT_SPAWN SPAWN_POSIX
+#endif
+
+/**
+ * @brief One fd operation applied in the child, in order, before exec.
+ * These map one to one onto posix_spawn file actions. TCSETPGRP makes the
+ * child's process group the foreground group of the terminal on `fd`.
+ */
+struct FdAction {
+  enum Kind { DUP2, CLOSE, TCSETPGRP } kind;
+  int fd;      // the fd being set up (DUP2 target, fd to close, terminal)
+  int src_fd;  // DUP2 source
+};
+
+/**
+ * @brief Everything needed to start one command.
+ *
+ * When `builtin` is set the child runs it on argv instead of exec'ing `path`,
+ * which always takes the fork backend: there is no image to exec, so the
+ * child needs its own copy of the shell.
+ */
+struct LaunchSpec {
+  const char *path = nullptr;  // resolved executable
+  char **argv = nullptr;       // nullptr-terminated
+  int (*builtin)(char **argv) = nullptr;
+  pid_t pgid = -1;  // -1: stay in the shell's group, 0: lead a new one
+  std::vector<FdAction> actions;
+
+  void dup2(int src_fd, int fd) { actions.push_back({FdAction::DUP2, fd, src_fd}); }
+  void close(int fd) { actions.push_back({FdAction::CLOSE, fd, -1}); }
+  void tcsetpgrp(int fd) { actions.push_back({FdAction::TCSETPGRP, fd, -1}); }
+};
+
+SpawnBackend spawn_backend();
+void set_spawn_backend(SpawnBackend backend);
+const char *spawn_backend_name(SpawnBackend backend);
+pid_t launch(const LaunchSpec &spec);
+std::vector<char *> script_argv(const char *path, char **argv);
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef _PARALLEL_H
+#define _PARALLEL_H
+
+#include <vector>
+
+class Process;
+
+/**
+ * @brief How pipelines joined by '&&&' (or given to the parallel builtin)
+ * are run.
+ */
+struct ParallelSettings {
+  int slots;    // pipelines running at once; 0 means one per online CPU
+  bool buffer;  // collect each job's stdout and write it out in one piece
+                // when the job finishes, so outputs never interleave
+};
+
+ParallelSettings &parallel_settings();
+int run_parallel(const std::vector<std::vector<Process *>> &pipelines,
+                 const ParallelSettings &settings);
+int parallel_builtin(char **argv);
+
+#endif
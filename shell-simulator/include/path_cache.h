@@ -0,0 +1,38 @@
+#ifndef _PATH_CACHE_H
+#define _PATH_CACHE_H
+
+#include <stdio.h>
+#include <string>
+#include <unordered_map>
+
+/**
+ * @brief bash-style command hash table: remembers where on PATH each command
+ * name was found so the shell can execve() the absolute path directly instead
+ * of having execvp() try every PATH directory in the child.
+ *
+ * Entries are filled on first use. The whole table is dropped when PATH
+ * changes, and a single entry is dropped when the file it points to is no
+ * longer executable.
+ */
+class PathCache {
+ public:
+  bool lookup(const char *name, std::string &path);
+  void forget();
+  void print(FILE *out) const;
+
+ private:
+  struct Entry {
+    std::string path;
+    int hits;
+  };
+
+  bool search(const char *name, std::string &path) const;
+
+  std::unordered_map<std::string, Entry> table;
+  std::string path_var;  // the PATH the table was built from
+};
+
+PathCache &path_cache();
+int hash_builtin(char **argv);
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef _SCRIPT_H
+#define _SCRIPT_H
+
+/**
+ * @brief for/while/until/if, run from a syntax tree.
+ *
+ * A line that uses one of these is read up to the matching done/fi, however
+ * many lines that takes, and parsed once into a tree whose leaves are
+ * parse_input() command lists, kept in the block's own arena. Running the
+ * tree copies a leaf's commands into the line arena and expands their
+ * variables, so a loop body is never tokenized again: each iteration costs
+ * only the commands it runs.
+ *
+ *   for NAME in words...; do list; done
+ *   while list; do list; done        (and until)
+ *   if list; then list; [elif list; then list;] [else list;] fi
+ *
+ * Keywords are recognised at the start of a command, i.e. after a newline,
+ * ';' or another keyword. Redirecting or piping a whole compound command is
+ * not supported.
+ */
+
+int block_depth(const char *begin, const char *end, bool &compound);
+bool run_block(char *text);
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef _SERVER_H
+#define _SERVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <string>
+
+/**
+ * @brief Frame types of the tsh daemon protocol. Every frame is a
+ * FrameHeader followed by `length` bytes of payload.
+ */
+enum FrameType : uint32_t {
+  FRAME_RUN = 1,  // client -> server: command line(s) to run as request `id`
+  FRAME_STDOUT,   // server -> client: a chunk of the request's stdout
+  FRAME_STDERR,   // server -> client: a chunk of the request's stderr
+  FRAME_EXIT,     // server -> client: int32 exit status, the request's last frame
+};
+
+struct FrameHeader {
+  uint32_t type;
+  uint32_t id;      // chosen by the client, echoed on every reply
+  uint32_t length;  // payload bytes that follow
+};
+
+#define MAX_FRAME_PAYLOAD (1 << 20)
+
+/**
+ * @brief Splits a byte stream into frames. fill() reads whatever the socket
+ * has; next() hands out complete frames from what has been read so far.
+ */
+class FrameReader {
+ public:
+  explicit FrameReader(int fd) : fd(fd), start(0), malformed(false) {}
+
+  // Returns bytes read, 0 at end of stream, -1 on error (errno set, EAGAIN
+  // included) or on a malformed frame (errno EPROTO).
+  ssize_t fill();
+  // False until a whole frame has been read. A header announcing more than
+  // MAX_FRAME_PAYLOAD bytes is left in `header`, and fill() fails from then on.
+  bool next(FrameHeader &header, std::string &payload);
+
+ private:
+  int fd;
+  std::string buffer;
+  size_t start;  // first unconsumed byte of buffer
+  bool malformed;
+};
+
+void append_frame(std::string &out, uint32_t type, uint32_t id,
+                  const void *data, uint32_t length);
+bool write_frame(int fd, uint32_t type, uint32_t id, const void *data,
+                 uint32_t length);
+bool read_frame(FrameReader &reader, FrameHeader &header,
+                std::string &payload);
+
+int connect_server(const char *socket_path);
+int run_server(const char *socket_path);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+/**
+ * @brief What one command cost, from the rusage wait4() reports when it is
+ * reaped. Builtins run in the shell use getrusage() deltas instead.
+ */
+struct ProcessStats {
+  pid_t pid;
+  std::string command;    // argv[0]
+  bool builtin;           // ran inside the shell, without a process
+  struct timespec start;  // CLOCK_MONOTONIC, just before the launch
+  struct timespec end;    // CLOCK_MONOTONIC, when it was reaped
+  struct rusage usage;
+  int status;             // in `$?` form
+  bool done;
+};
+
+double seconds_between(const struct timespec &start,
+                       const struct timespec &end);
+void usage_delta(const struct rusage &before, struct rusage &after);
+void print_stats(FILE *out, const std::vector<ProcessStats> &stats);
+void log_stats(const ProcessStats &stats, int job_id);
+
+#endif
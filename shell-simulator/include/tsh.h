@@ -1,9 +1,15 @@
 #ifndef _SIMPLE_SHELL_H
 #define _SIMPLE_SHELL_H
 
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -12,8 +18,21 @@
 #include <iostream>
 #include <list>
 #include <map>
+#include <string>
 #include <vector>
 
+#include <arena.h>
+#include <builtins.h>
+#include <glob_cache.h>
+#include <jobs.h>
+#include <launch.h>
+#include <parallel.h>
+#include <path_cache.h>
+#include <script.h>
+#include <server.h>
+#include <stats.h>
+#include <zygote.h>
+
 #ifdef DEBUGMODE
 #define debug(msg) \
   std::cout << "[" << __FILE__ << ":" << __LINE__ << "] " << msg << std::endl;
@@ -23,29 +42,57 @@
 
 using namespace std;
 
-#define MAX_LINE 81
+/**
+ * @brief One redirection of a command: `fd` is opened on `target` (READ
+ * `<`, WRITE `>`, APPEND `>>`) or made a copy of `src_fd` (DUP `n>&m`).
+ */
+struct Redirect {
+  int fd;
+  enum Kind { READ, WRITE, APPEND, DUP } kind;
+  char *target;  // file name; nullptr for DUP or when it was left out
+  int src_fd;
+};
 
 class Process {
  public:
-  Process(bool _pipe_in_flag, bool _pipe_out_flag);
+  Process(bool _pipe_in_flag, bool _pipe_out_flag, Arena *_arena = nullptr);
   ~Process();
 
   void add_token(char *tok);
-  char *cmdTokens[50];
+  void add_redirect(const Redirect &redirect);
+  char **cmdTokens;
+  Redirect *redirects;  // in the order they were written
+  int redirect_count;
+  int redirect_capacity;
 
   bool pipe_in;
   bool pipe_out;
+  bool background;  // last command of a pipeline followed by '&'
+  bool parallel;    // last command of a pipeline followed by '&&&'
+  bool and_then;    // last command of a pipeline followed by '&&'
+  bool or_else;     // last command of a pipeline followed by '||'
 
   int pipe_fd[2];
   int tok_index;
+  int tok_capacity;
+  Arena *arena;  // backs cmdTokens and redirects when set, otherwise the heap
 };
 
+Arena &line_arena();
+bool &interactive();
 void run();
+bool run_lines(char *text, size_t len);
+int run_script(const char *filename);
 void display_prompt();
 void cleanup(list<Process *> &process_list, char *input_line);
 char *read_input();
-void parse_input(char *input_line, list<Process *> &process_list);
+void parse_input(char *input_line, list<Process *> &process_list,
+                 Arena &arena = line_arena());
 bool run_commands(list<Process *> &command_list);
+void expand_word(const char *word, string &out);
+void expand_fields(const char *word, vector<string> &fields);
+Job *launch_pipeline(const vector<Process *> &stages, int out_fd = -1,
+                     bool grouped = true);
 bool isQuit(Process *process);
 void sanitize(char *cmd);
 
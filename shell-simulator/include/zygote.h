@@ -0,0 +1,41 @@
+#ifndef _ZYGOTE_H
+#define _ZYGOTE_H
+
+#include <launch.h>
+#include <sys/types.h>
+
+/**
+ * @brief A pre-forked helper that keeps children parked, ready to exec.
+ *
+ * The zygote is forked from the shell on first use and keeps `parked`
+ * children (TSH_ZYGOTE_CHILDREN, default 2) blocked in recvmsg() on a
+ * SOCK_SEQPACKET socket shared with the shell. To launch a command the shell
+ * sends one message: the path, argv, environment and working directory,
+ * the fd actions, and the fds themselves as SCM_RIGHTS. Whichever parked
+ * child receives it replies with its pid, wires its fds and execs; the
+ * zygote parks a replacement in the background. The fork is off the
+ * shell's critical path. When the zygote cannot be used, launch() says so
+ * and the caller falls back to posix_spawn().
+ *
+ * Parked children are cloned with CLONE_PARENT, so they are the shell's own
+ * children, not the zygote's. The shell's SIGCHLD handler, setpgid() and
+ * wait logic therefore work on them unchanged.
+ */
+class Zygote {
+ public:
+  Zygote();
+
+  // Returns the child's pid, -1 if it could not be started, or -2 if the
+  // zygote is unavailable and another backend should be used.
+  pid_t launch(const LaunchSpec &spec);
+  bool start();
+
+ private:
+  int sock;     // the shell's end; -1 until started
+  pid_t pid;    // the zygote itself
+  bool failed;  // could not be started or went away
+};
+
+Zygote &zygote();
+
+#endif
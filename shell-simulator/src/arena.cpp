@@ -0,0 +1,69 @@
+#include <arena.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * @brief Creates an empty arena; the first block is allocated on first use.
+ *
+ * @param _block_size minimum size of each block in bytes
+ */
+Arena::Arena(size_t _block_size)
+    : head(nullptr), current(nullptr), block_size(_block_size) {}
+
+/**
+ * @brief Frees every block owned by the arena.
+ */
+Arena::~Arena() {
+  while (head != nullptr) {
+    Block *next = head->next;
+    free(head);
+    head = next;
+  }
+}
+
+Arena::Block *Arena::new_block(size_t size) {
+  Block *block = (Block *)malloc(sizeof(Block) + size);
+  if (block == nullptr) {
+    throw std::bad_alloc();
+  }
+  block->next = nullptr;
+  block->size = size;
+  block->used = 0;
+  return block;
+}
+
+/**
+ * @brief Returns `size` bytes aligned to `align`, moving on to the next block
+ * (or chaining a new one) when the current block is full.
+ */
+void *Arena::alloc(size_t size, size_t align) {
+  if (current == nullptr) {
+    head = current = new_block(block_size);
+  }
+
+  while (true) {
+    uintptr_t base = (uintptr_t)current->data();
+    uintptr_t start = (base + current->used + align - 1) & ~(uintptr_t)(align - 1);
+    if (start + size <= base + current->size) {
+      current->used = start + size - base;
+      return (void *)start;
+    }
+
+    if (current->next == nullptr) {
+      size_t needed = size + align;
+      current->next = new_block(needed > block_size ? needed : block_size);
+    }
+    current = current->next;
+    current->used = 0;
+  }
+}
+
+/**
+ * @brief Releases every allocation at once, keeping the blocks for reuse.
+ */
+void Arena::reset() {
+  for (Block *block = head; block != nullptr; block = block->next) {
+    block->used = 0;
+  }
+  current = head;
+}
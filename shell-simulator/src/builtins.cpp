@@ -0,0 +1,359 @@
+#include <builtins.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <jobs.h>
+#include <limits.h>
+#include <parallel.h>
+#include <path_cache.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <map>
+#include <string>
+
+using namespace std;
+
+/**
+ * @brief Exit status of the last pipeline, as `$?` reports it.
+ */
+int &last_status() {
+  static int status = 0;
+  return status;
+}
+
+/**
+ * @brief Set by the exit builtin when it runs in the shell itself; the main
+ * loop stops once the current line is done.
+ */
+bool &exit_requested() {
+  static bool requested = false;
+  return requested;
+}
+
+/**
+ * @brief `set -o pipefail`: a pipeline's status is that of the last command
+ * that failed rather than the last command.
+ */
+bool &pipefail() {
+  static bool enabled = false;
+  return enabled;
+}
+
+/**
+ * @brief Variables set with NAME=value that are not exported. Exported ones
+ * live only in the environment, so children see their current value.
+ */
+static map<string, string> &shell_variables() {
+  static map<string, string> variables;
+  return variables;
+}
+
+static bool is_name_start(char c) { return isalpha(c) || c == '_'; }
+
+/**
+ * @brief Whether `word` is NAME=value, NAME being a valid variable name.
+ */
+bool is_assignment(const char *word) {
+  if (!is_name_start(*word))
+    return false;
+  while (isalnum(*word) || *word == '_')
+    word++;
+  return *word == '=';
+}
+
+/**
+ * @brief The value of the variable whose name is the first `length` bytes of
+ * `name`, or nullptr if it is not set.
+ */
+const char *get_variable(const char *name, size_t length) {
+  string key(name, length);
+  map<string, string> &variables = shell_variables();
+  auto it = variables.find(key);
+  return it != variables.end() ? it->second.c_str() : getenv(key.c_str());
+}
+
+/**
+ * @brief Assigns a variable. One that is exported stays exported, with the
+ * new value; any other is kept by the shell only.
+ */
+void set_variable(const char *name, size_t length, const char *value) {
+  string key(name, length);
+  if (getenv(key.c_str()) != nullptr) {
+    setenv(key.c_str(), value, 1);
+  } else {
+    shell_variables()[key] = value;
+  }
+}
+
+static int builtin_cd(char **argv) {
+  const char *dir = argv[1];
+  if (dir == nullptr) {
+    dir = getenv("HOME");
+    if (dir == nullptr) {
+      fprintf(stderr, "tsh: cd: HOME not set\n");
+      return 1;
+    }
+  } else if (strcmp(dir, "-") == 0) {
+    dir = getenv("OLDPWD");
+    if (dir == nullptr) {
+      fprintf(stderr, "tsh: cd: OLDPWD not set\n");
+      return 1;
+    }
+    printf("%s\n", dir);
+  }
+
+  char old_cwd[PATH_MAX];
+  bool have_old = getcwd(old_cwd, sizeof(old_cwd)) != nullptr;
+  if (chdir(dir) == -1) {
+    fprintf(stderr, "tsh: cd: %s: %s\n", dir, strerror(errno));
+    return 1;
+  }
+
+  char cwd[PATH_MAX];
+  if (have_old) {
+    setenv("OLDPWD", old_cwd, 1);
+  }
+  if (getcwd(cwd, sizeof(cwd)) != nullptr) {
+    setenv("PWD", cwd, 1);
+  }
+  return 0;
+}
+
+static int builtin_pwd(char **) {
+  char cwd[PATH_MAX];
+  if (getcwd(cwd, sizeof(cwd)) == nullptr) {
+    perror("tsh: pwd");
+    return 1;
+  }
+  printf("%s\n", cwd);
+  return 0;
+}
+
+static int builtin_echo(char **argv) {
+  int i = 1;
+  bool newline = true;
+  if (argv[i] != nullptr && strcmp(argv[i], "-n") == 0) {
+    newline = false;
+    i++;
+  }
+  for (; argv[i] != nullptr; i++) {
+    fputs(argv[i], stdout);
+    if (argv[i + 1] != nullptr)
+      putchar(' ');
+  }
+  if (newline)
+    putchar('\n');
+  return 0;
+}
+
+static int builtin_true(char **) { return 0; }
+
+static int builtin_false(char **) { return 1; }
+
+extern char **environ;
+
+static int builtin_export(char **argv) {
+  if (argv[1] == nullptr) {
+    for (char **env = environ; *env != nullptr; env++) {
+      printf("export %s\n", *env);
+    }
+    return 0;
+  }
+
+  int status = 0;
+  for (int i = 1; argv[i] != nullptr; i++) {
+    char *eq = strchr(argv[i], '=');
+    if (eq == nullptr) {  // export a variable set earlier
+      auto it = shell_variables().find(argv[i]);
+      if (it != shell_variables().end()) {
+        setenv(argv[i], it->second.c_str(), 1);
+        shell_variables().erase(it);
+      }
+      continue;
+    }
+    *eq = '\0';
+    shell_variables().erase(argv[i]);
+    if (eq == argv[i] || setenv(argv[i], eq + 1, 1) == -1) {
+      fprintf(stderr, "tsh: export: `%s=%s': not a valid identifier\n",
+              argv[i], eq + 1);
+      status = 1;
+    }
+    *eq = '=';
+  }
+  return status;
+}
+
+static int builtin_exit(char **argv) {
+  int status = last_status();
+  if (argv[1] != nullptr) {
+    char *end;
+    status = strtol(argv[1], &end, 10);
+    if (*end != '\0') {
+      fprintf(stderr, "tsh: exit: %s: numeric argument required\n", argv[1]);
+      status = 2;
+    }
+  }
+  exit_requested() = true;
+  return status & 0xff;
+}
+
+/**
+ * @brief set [-o|+o option]: turns a shell option on (-o) or off (+o); with
+ * no arguments (or just -o) lists them. pipefail is the only one.
+ */
+static int builtin_set(char **argv) {
+  if (argv[1] == nullptr ||
+      (strcmp(argv[1], "-o") == 0 && argv[2] == nullptr)) {
+    printf("pipefail\t%s\n", pipefail() ? "on" : "off");
+    return 0;
+  }
+  int status = 0;
+  for (int i = 1; argv[i] != nullptr; i++) {
+    bool on = strcmp(argv[i], "-o") == 0;
+    if ((!on && strcmp(argv[i], "+o") != 0) || argv[i + 1] == nullptr) {
+      fprintf(stderr, "usage: set [-o|+o pipefail]\n");
+      return 2;
+    }
+    if (strcmp(argv[++i], "pipefail") == 0) {
+      pipefail() = on;
+    } else {
+      fprintf(stderr, "tsh: set: %s: invalid option name\n", argv[i]);
+      status = 1;
+    }
+  }
+  return status;
+}
+
+#ifdef TSH_FAST_CAT
+
+#ifndef TSH_CAT_PIPE_SIZE
+#define TSH_CAT_PIPE_SIZE (1 << 20)
+#endif
+
+/**
+ * @brief Moves everything from in_fd to out_fd inside the kernel: splice()
+ * when either side is a pipe, sendfile() from a regular file otherwise, and
+ * read()/write() only when neither applies (e.g. a terminal on both ends).
+ *
+ * @return 0, or -1 with errno set
+ */
+static int copy_fd(int in_fd, int out_fd, bool in_pipe, bool out_pipe) {
+  const size_t chunk = TSH_CAT_PIPE_SIZE;
+  if (in_pipe || out_pipe) {
+    ssize_t n;
+    while ((n = splice(in_fd, nullptr, out_fd, nullptr, chunk,
+                       SPLICE_F_MOVE | SPLICE_F_MORE)) > 0) {
+    }
+    if (n == 0)
+      return 0;
+    if (errno != EINVAL)
+      return -1;
+  } else {
+    ssize_t n;
+    while ((n = sendfile(out_fd, in_fd, nullptr, chunk)) > 0) {
+    }
+    if (n == 0)
+      return 0;
+    if (errno != EINVAL && errno != ENOSYS)
+      return -1;
+  }
+
+  char buf[65536];
+  ssize_t n;
+  while ((n = read(in_fd, buf, sizeof(buf))) > 0) {
+    for (ssize_t done = 0; done < n;) {
+      ssize_t w = write(out_fd, buf + done, n - done);
+      if (w == -1)
+        return -1;
+      done += w;
+    }
+  }
+  return n == 0 ? 0 : -1;
+}
+
+static bool is_pipe(int fd) {
+  struct stat st;
+  return fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+}
+
+/**
+ * @brief The builtin cat only takes plain file names; options, `-` and
+ * reading stdin are left to the real cat.
+ */
+static bool cat_accepts(char **argv) {
+  if (argv[1] == nullptr)
+    return false;
+  for (int i = 1; argv[i] != nullptr; i++) {
+    if (argv[i][0] == '-')
+      return false;
+  }
+  return true;
+}
+
+/**
+ * @brief cat file... without an exec or user-space copies. It always runs in
+ * a forked child (a fifo or /dev/zero would otherwise hang the shell where
+ * Ctrl-C cannot reach it); a pipeline pipe it writes into has been grown to
+ * TSH_CAT_PIPE_SIZE by the shell so each splice() moves more.
+ */
+static int builtin_cat(char **argv) {
+  fflush(stdout);
+  bool out_pipe = is_pipe(STDOUT_FILENO);
+
+  int status = 0;
+  for (int i = 1; argv[i] != nullptr; i++) {
+    int fd = open(argv[i], O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+      fprintf(stderr, "cat: %s: %s\n", argv[i], strerror(errno));
+      status = 1;
+      continue;
+    }
+    if (copy_fd(fd, STDOUT_FILENO, is_pipe(fd), out_pipe) == -1) {
+      fprintf(stderr, "cat: %s: %s\n", argv[i], strerror(errno));
+      status = 1;
+    }
+    close(fd);
+  }
+  return status;
+}
+
+#endif  // TSH_FAST_CAT
+
+static const Builtin builtins[] = {
+    {"cd", builtin_cd, nullptr},
+    {"pwd", builtin_pwd, nullptr},
+    {"echo", builtin_echo, nullptr},
+    {"true", builtin_true, nullptr},
+    {"false", builtin_false, nullptr},
+    {"export", builtin_export, nullptr},
+    {"exit", builtin_exit, nullptr},
+    {"set", builtin_set, nullptr},
+    {"hash", hash_builtin, nullptr},
+    {"jobs", jobs_builtin, nullptr},
+    {"fg", fg_builtin, nullptr},
+    {"bg", bg_builtin, nullptr},
+    {"wait", wait_builtin, nullptr},
+    {"parallel", parallel_builtin, nullptr},
+#ifdef TSH_FAST_CAT
+    {"cat", builtin_cat, cat_accepts, true, TSH_CAT_PIPE_SIZE},
+#endif
+};
+
+/**
+ * @brief Looks a command up in the builtin dispatch table.
+ *
+ * @return the builtin, or nullptr if argv is an external command (including
+ * a builtin name with arguments its builtin leaves to the external command)
+ */
+const Builtin *find_builtin(char **argv) {
+  for (const Builtin &builtin : builtins) {
+    if (strcmp(builtin.name, argv[0]) == 0)
+      return builtin.accepts == nullptr || builtin.accepts(argv) ? &builtin
+                                                                 : nullptr;
+  }
+  return nullptr;
+}
@@ -0,0 +1,118 @@
+#include <server.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+
+/**
+ * @brief Sends command lines to a `tsh_app --server` daemon and relays what
+ * comes back.
+ *
+ *   tsh_client socket 'commands'   runs one command line
+ *   tsh_client [-j N] socket       runs each line of stdin, N at a time
+ *                                  (default 1, i.e. in order)
+ *
+ * The output of each request is written to stdout/stderr as it arrives; with
+ * -j above 1 the chunks of concurrent requests interleave. Exits with the
+ * status of the last request to finish, or 255 if the daemon could not be
+ * reached or went away.
+ */
+
+static bool send_line(int fd, uint32_t id, const char *line, size_t length) {
+  if (length > MAX_FRAME_PAYLOAD) {
+    fprintf(stderr, "tsh_client: line %u is too long\n", id);
+    return false;
+  }
+  return write_frame(fd, FRAME_RUN, id, line, length);
+}
+
+static void write_out(int fd, const std::string &data) {
+  size_t done = 0;
+  while (done < data.size()) {
+    ssize_t n = write(fd, data.data() + done, data.size() - done);
+    if (n <= 0)
+      return;
+    done += n;
+  }
+}
+
+int main(int argc, char **argv) {
+  int jobs = 1;
+  int opt;
+  while ((opt = getopt(argc, argv, "j:")) != -1) {
+    if (opt == 'j') {
+      jobs = atoi(optarg) > 0 ? atoi(optarg) : 1;
+    } else {
+      fprintf(stderr, "usage: %s [-j N] socket ['commands']\n", argv[0]);
+      return 2;
+    }
+  }
+  if (optind >= argc) {
+    fprintf(stderr, "usage: %s [-j N] socket ['commands']\n", argv[0]);
+    return 2;
+  }
+
+  int fd = connect_server(argv[optind]);
+  if (fd == -1) {
+    perror(argv[optind]);
+    return 255;
+  }
+
+  const char *command = optind + 1 < argc ? argv[optind + 1] : nullptr;
+  uint32_t next_id = 1;
+  int in_flight = 0;
+  bool more = true;
+  char *line = nullptr;
+  size_t capacity = 0;
+
+  // Keeps up to `jobs` requests running until the input runs out.
+  auto refill = [&]() {
+    while (more && in_flight < jobs) {
+      if (command != nullptr) {
+        more = false;
+        if (!send_line(fd, next_id++, command, strlen(command)))
+          return false;
+      } else {
+        ssize_t length = getline(&line, &capacity, stdin);
+        if (length == -1) {
+          more = false;
+          break;
+        }
+        if (!send_line(fd, next_id++, line, length))
+          return false;
+      }
+      in_flight++;
+    }
+    return true;
+  };
+
+  FrameReader reader(fd);
+  FrameHeader header;
+  std::string payload;
+  int status = 0;
+  if (!refill()) {
+    return 255;
+  }
+  while (in_flight > 0) {
+    if (!read_frame(reader, header, payload)) {
+      fprintf(stderr, "tsh_client: connection to the daemon lost\n");
+      return 255;
+    }
+    if (header.type == FRAME_STDOUT) {
+      write_out(STDOUT_FILENO, payload);
+    } else if (header.type == FRAME_STDERR) {
+      write_out(STDERR_FILENO, payload);
+    } else if (header.type == FRAME_EXIT && payload.size() == sizeof(int32_t)) {
+      int32_t code;
+      memcpy(&code, payload.data(), sizeof(code));
+      status = code;
+      in_flight--;
+      if (!refill())
+        return 255;
+    }
+  }
+  free(line);
+  close(fd);
+  return status;
+}
@@ -0,0 +1,199 @@
+#include <glob_cache.h>
+#include <algorithm>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Bytes asked of each getdents64() call.
+#define GETDENTS_CHUNK (256 << 10)
+
+// The record getdents64() fills in; glibc does not declare it.
+struct linux_dirent64 {
+  ino64_t d_ino;
+  off64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+/**
+ * @brief The directory cache shared by the whole shell.
+ */
+GlobCache &glob_cache() {
+  static GlobCache cache;
+  return cache;
+}
+
+/**
+ * @brief Whether `word` has a `*`, a `?` or a `[` closed by a later `]`. A
+ * lone `[` (the test command) is not a pattern.
+ */
+bool has_glob(const char *word) {
+  for (const char *c = word; *c != '\0'; c++) {
+    if (*c == '*' || *c == '?')
+      return true;
+    if (*c == '[' && strchr(c + 1, ']') != nullptr)
+      return true;
+  }
+  return false;
+}
+
+/**
+ * @brief The entries of `dir` ("" being the current directory), read on
+ * first use of the directory it names. A directory that cannot be read lists
+ * nothing.
+ */
+const GlobCache::Listing &GlobCache::list(const string &dir) {
+  static const Listing unreadable;
+  int fd = open(dir.empty() ? "." : dir.c_str(),
+                O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  struct stat st;
+  if (fd == -1)
+    return unreadable;
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    return unreadable;
+  }
+  auto found = listings.find({st.st_dev, st.st_ino});
+  if (found != listings.end()) {
+    close(fd);
+    return found->second;
+  }
+
+  Listing &listing = listings[{st.st_dev, st.st_ino}];
+  size_t used = 0;
+  while (true) {
+    if (listing.buffer.size() - used < GETDENTS_CHUNK)
+      listing.buffer.resize(used + GETDENTS_CHUNK);
+    long n = syscall(SYS_getdents64, fd, listing.buffer.data() + used,
+                     listing.buffer.size() - used);
+    if (n <= 0)
+      break;
+    used += n;
+  }
+  close(fd);
+  listing.buffer.resize(used);
+
+  for (size_t at = 0; at < used;) {
+    const linux_dirent64 *entry =
+        (const linux_dirent64 *)(listing.buffer.data() + at);
+    const char *name = entry->d_name;
+    if (strcmp(name, ".") != 0 && strcmp(name, "..") != 0) {
+      listing.names.push_back(name - listing.buffer.data());
+      listing.types.push_back(entry->d_type);
+    }
+    at += entry->d_reclen;
+  }
+  return listing;
+}
+
+// Whether entry i of `listing` (in directory `prefix`) is a directory; not
+// following symlinks, so `**` never loops.
+bool GlobCache::is_directory(const string &prefix, const Listing &listing,
+                             size_t i) {
+  if (listing.types[i] != DT_UNKNOWN)
+    return listing.types[i] == DT_DIR;
+  struct stat st;
+  string path = prefix + (listing.buffer.data() + listing.names[i]);
+  return lstat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/**
+ * @brief Adds to `matches` every path matching components[index..] inside
+ * `prefix` (empty, or a directory ending in '/').
+ */
+void GlobCache::walk(const vector<string> &components, size_t index,
+                     const string &prefix, vector<string> &matches) {
+  if (index == components.size()) {
+    matches.push_back(prefix);
+    return;
+  }
+  const string &component = components[index];
+  bool last = index + 1 == components.size();
+
+  if (!has_glob(component.c_str())) {
+    string path = prefix + component;
+    struct stat st;
+    if (last) {
+      if (lstat(path.c_str(), &st) == 0)
+        matches.push_back(path);
+    } else {
+      walk(components, index + 1, path + '/', matches);
+    }
+    return;
+  }
+
+  const Listing &listing = list(prefix);
+  bool globstar = component == "**";
+  if (globstar && !last)  // no directories at all
+    walk(components, index + 1, prefix, matches);
+  for (size_t i = 0; i < listing.names.size(); i++) {
+    const char *name = listing.buffer.data() + listing.names[i];
+    if (globstar) {
+      if (name[0] == '.')
+        continue;
+      bool directory = is_directory(prefix, listing, i);
+      if (last)
+        matches.push_back(prefix + name);
+      if (directory)  // one more directory
+        walk(components, index, prefix + name + '/', matches);
+    } else if (fnmatch(component.c_str(), name, FNM_PERIOD) == 0) {
+      if (last) {
+        matches.push_back(prefix + name);
+      } else if (is_directory(prefix, listing, i) ||
+                 listing.types[i] == DT_LNK) {
+        walk(components, index + 1, prefix + name + '/', matches);
+      }
+    }
+  }
+}
+
+/**
+ * @brief Appends the sorted paths matching `pattern` to `words`, or the
+ * pattern itself if nothing matches.
+ */
+void GlobCache::expand(const char *pattern, vector<string> &words) {
+  auto found = results.find(pattern);
+  if (found == results.end()) {
+    vector<string> components;
+    string prefix;
+    const char *c = pattern;
+    if (*c == '/')
+      prefix = "/";
+    while (*c != '\0') {
+      const char *slash = strchr(c, '/');
+      size_t length = slash ? (size_t)(slash - c) : strlen(c);
+      if (length > 0 || slash == nullptr)
+        components.emplace_back(c, length);
+      c += length + (slash != nullptr);
+    }
+    if (pattern[strlen(pattern) - 1] == '/')  // only directories
+      components.emplace_back();
+
+    vector<string> matches;
+    walk(components, 0, prefix, matches);
+    sort(matches.begin(), matches.end());
+    matches.erase(unique(matches.begin(), matches.end()), matches.end());
+    found = results.emplace(pattern, std::move(matches)).first;
+  }
+  if (found->second.empty()) {
+    words.push_back(pattern);
+  } else {
+    words.insert(words.end(), found->second.begin(), found->second.end());
+  }
+}
+
+/**
+ * @brief Drops every listing and result, so the next command sees the
+ * directories as they are then.
+ */
+void GlobCache::forget() {
+  listings.clear();
+  results.clear();
+}
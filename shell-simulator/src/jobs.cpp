@@ -0,0 +1,672 @@
+#include <builtins.h>
+#include <errno.h>
+#include <jobs.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+/*** SIGCHLD reaping ***/
+
+#define CHILD_EVENTS 256
+
+struct ChildEvent {
+  pid_t pid;
+  int status;
+  struct rusage usage;
+  struct timespec end;  // CLOCK_MONOTONIC when it was reaped
+};
+
+// Written only by the handler and read only with SIGCHLD blocked.
+static ChildEvent child_events[CHILD_EVENTS];
+static volatile sig_atomic_t events_head = 0;
+static volatile sig_atomic_t events_tail = 0;
+
+/**
+ * @brief Reaps every child with news into child_events. When the ring is full
+ * the rest stay unreaped until JobTable::update() collects them itself.
+ */
+static void on_sigchld(int) {
+  int saved_errno = errno;
+  while (events_tail - events_head < CHILD_EVENTS) {
+    ChildEvent &event = child_events[events_tail % CHILD_EVENTS];
+    event.pid = wait4(-1, &event.status, WNOHANG | WUNTRACED | WCONTINUED,
+                      &event.usage);
+    if (event.pid <= 0)
+      break;
+    clock_gettime(CLOCK_MONOTONIC, &event.end);
+    events_tail = events_tail + 1;
+  }
+  errno = saved_errno;
+}
+
+static void block_sigchld(sigset_t *old) {
+  sigset_t chld;
+  sigemptyset(&chld);
+  sigaddset(&chld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &chld, old);
+}
+
+// How long a timed-out job has between SIGTERM and SIGKILL.
+#define TIMEOUT_GRACE_NS 1000000000L
+// `$?` of a job stopped by its deadline, as timeout(1) reports it.
+#define TIMEOUT_STATUS 124
+
+static int exit_status(int status) {
+  if (WIFEXITED(status))
+    return WEXITSTATUS(status);
+  if (WIFSIGNALED(status))
+    return 128 + WTERMSIG(status);
+  return 128 + WSTOPSIG(status);
+}
+
+/*** JobTable ***/
+
+/**
+ * @brief The job table shared by the whole shell. Creating it installs the
+ * SIGCHLD handler, so nothing else in the shell may waitpid() on its own.
+ */
+JobTable &job_table() {
+  static JobTable table;
+  return table;
+}
+
+JobTable::JobTable() : control(false), shell_pgid(getpgrp()) {
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_sigchld;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = SA_RESTART;
+  sigaction(SIGCHLD, &sa, nullptr);
+}
+
+/**
+ * @brief Turns on job control: the shell leads its own process group, owns
+ * the terminal between jobs and ignores the terminal's job control signals.
+ * launch() restores their defaults in every child.
+ */
+void JobTable::enable_job_control() {
+  signal(SIGINT, SIG_IGN);
+  signal(SIGQUIT, SIG_IGN);
+  signal(SIGTSTP, SIG_IGN);
+  signal(SIGTTIN, SIG_IGN);
+  signal(SIGTTOU, SIG_IGN);
+  setpgid(0, 0);
+  shell_pgid = getpgrp();
+  tcsetpgrp(STDIN_FILENO, shell_pgid);
+  control = true;
+}
+
+/**
+ * @brief Registers a new pipeline. Ids continue after the highest one in use,
+ * as in bash. A grouped job gets its own process group under job control.
+ */
+Job *JobTable::create(bool background, bool grouped) {
+  Job job;
+  job.id = jobs.empty() ? 1 : jobs.back().id + 1;
+  job.grouped = control && grouped;
+  job.pgid = 0;
+  job.live = 0;
+  job.last_pid = -1;
+  job.status = 0;
+  job.state = JOB_RUNNING;
+  job.background = background;
+  job.timed = false;
+  job.deadline = {0, 0};
+  job.timeout_signal = 0;
+
+  // TSH_TIMEOUT=seconds bounds every pipeline started while it is set.
+  const char *timeout = getenv("TSH_TIMEOUT");
+  double seconds = timeout != nullptr ? strtod(timeout, nullptr) : 0;
+  if (seconds > 0) {
+    clock_gettime(CLOCK_MONOTONIC, &job.deadline);
+    long ns = job.deadline.tv_nsec + (long)((seconds - (long)seconds) * 1e9);
+    job.deadline.tv_sec += (time_t)seconds + ns / 1000000000L;
+    job.deadline.tv_nsec = ns % 1000000000L;
+  }
+  jobs.push_back(job);
+  return &jobs.back();
+}
+
+/**
+ * @brief Records a launched process as the job's newest last stage, along
+ * with when its launch began. With job control the first process leads the
+ * job's process group; the parent also calls setpgid() so the group exists
+ * before the next stage joins it.
+ */
+void JobTable::add_process(Job *job, pid_t pid, const char *command,
+                           const struct timespec &start) {
+  if (job->grouped) {
+    if (job->pgid == 0)
+      job->pgid = pid;
+    setpgid(pid, job->pgid);
+  }
+  job->pids.push_back(pid);
+  ProcessStats stats;
+  memset(&stats.usage, 0, sizeof(stats.usage));
+  stats.pid = pid;
+  stats.command = command;
+  stats.builtin = false;
+  stats.start = start;
+  stats.end = start;
+  stats.status = 0;
+  stats.done = false;
+  job->stats.push_back(stats);
+  job->live++;
+  job->last_pid = pid;
+}
+
+/**
+ * @brief Records a stage that could not be started, with the status it
+ * failed with, so `time` and pipefail see it in its place.
+ */
+void JobTable::add_failure(Job *job, const char *command, int status) {
+  ProcessStats stats;
+  memset(&stats.usage, 0, sizeof(stats.usage));
+  stats.pid = -1;
+  stats.command = command;
+  stats.builtin = false;
+  clock_gettime(CLOCK_MONOTONIC, &stats.start);
+  stats.end = stats.start;
+  stats.status = status;
+  stats.done = true;
+  job->stats.push_back(stats);
+  job->last_pid = -1;
+  job->status = status;
+}
+
+/**
+ * @brief Called once the whole pipeline is launched: background jobs are
+ * announced and left running, foreground jobs are waited for and their
+ * status becomes `$?`.
+ */
+void JobTable::finish(Job *job) {
+  if (job->pids.empty()) {  // nothing could be started
+    last_status() = job->status;
+    remove(job);
+    return;
+  }
+  if (job->background) {
+    if (control)
+      fprintf(stderr, "[%d] %d\n", job->id, job->last_pid);
+    update();
+    return;
+  }
+  resume(job, true);
+}
+
+/**
+ * @brief Applies one child state change to the job that owns the pid and,
+ * when the child is gone, records and logs what it cost. Children that are
+ * not part of a job are ignored.
+ */
+void JobTable::apply(pid_t pid, int status, const struct rusage &usage,
+                     const struct timespec &end) {
+  Job *job = find_pid(pid);
+  if (job == nullptr)
+    return;
+
+  if (WIFSTOPPED(status)) {
+    job->state = JOB_STOPPED;
+    job->status = exit_status(status);
+  } else if (WIFCONTINUED(status)) {
+    job->state = JOB_RUNNING;
+  } else {
+    if (pid == job->last_pid)
+      job->status = exit_status(status);
+    for (ProcessStats &stats : job->stats) {
+      if (stats.pid != pid)
+        continue;
+      stats.usage = usage;
+      stats.end = end;
+      stats.status = exit_status(status);
+      stats.done = true;
+      log_stats(stats, job->id);
+    }
+    if (--job->live == 0) {
+      job->state = JOB_DONE;
+      if (job->timeout_signal != 0) {
+        job->status = TIMEOUT_STATUS;
+      } else if (pipefail()) {
+        job->status = 0;
+        for (const ProcessStats &stats : job->stats) {
+          if (stats.status != 0)
+            job->status = stats.status;
+        }
+      }
+    }
+  }
+}
+
+static void signal_job(const Job *job, int sig) {
+  if (job->pgid != 0) {
+    kill(-job->pgid, sig);
+    return;
+  }
+  for (const ProcessStats &stats : job->stats) {
+    if (!stats.done)
+      kill(stats.pid, sig);
+  }
+}
+
+/**
+ * @brief Called when a job's deadline passes: the first time it is sent
+ * SIGTERM (and SIGCONT, should it be stopped) and given a grace period, the
+ * second time SIGKILL.
+ */
+void JobTable::expire(Job *job) {
+  if (job->timeout_signal == 0) {
+    fprintf(stderr, "tsh: timed out: %s\n", job->command.c_str());
+    job->timeout_signal = SIGTERM;
+    signal_job(job, SIGTERM);
+    signal_job(job, SIGCONT);
+    job->deadline.tv_nsec += TIMEOUT_GRACE_NS;
+    job->deadline.tv_sec += job->deadline.tv_nsec / 1000000000L;
+    job->deadline.tv_nsec %= 1000000000L;
+  } else {
+    job->timeout_signal = SIGKILL;
+    signal_job(job, SIGKILL);
+    job->deadline = {0, 0};
+  }
+}
+
+static bool passed(const struct timespec &deadline,
+                   const struct timespec &now) {
+  return deadline.tv_sec != 0 &&
+         (now.tv_sec > deadline.tv_sec ||
+          (now.tv_sec == deadline.tv_sec && now.tv_nsec >= deadline.tv_nsec));
+}
+
+/**
+ * @brief Drains the events the SIGCHLD handler collected into the jobs, then
+ * reaps whatever did not fit in the ring, and acts on deadlines that have
+ * passed.
+ */
+void JobTable::update() {
+  sigset_t old;
+  block_sigchld(&old);
+  while (events_head != events_tail) {
+    const ChildEvent &event = child_events[events_head % CHILD_EVENTS];
+    apply(event.pid, event.status, event.usage, event.end);
+    events_head = events_head + 1;
+  }
+  ChildEvent event;
+  while ((event.pid = wait4(-1, &event.status,
+                            WNOHANG | WUNTRACED | WCONTINUED, &event.usage)) >
+         0) {
+    clock_gettime(CLOCK_MONOTONIC, &event.end);
+    apply(event.pid, event.status, event.usage, event.end);
+  }
+
+  struct timespec now = {0, 0};
+  for (Job &job : jobs) {
+    if (job.deadline.tv_sec == 0 || job.state == JOB_DONE)
+      continue;
+    if (now.tv_sec == 0)
+      clock_gettime(CLOCK_MONOTONIC, &now);
+    if (passed(job.deadline, now))
+      expire(&job);
+  }
+  sigprocmask(SIG_SETMASK, &old, nullptr);
+}
+
+/**
+ * @brief The nearest deadline of a job that is not done, background jobs
+ * included.
+ * @return that deadline, or nullptr if no job has one
+ */
+const struct timespec *JobTable::nearest_deadline() const {
+  const struct timespec *nearest = nullptr;
+  for (const Job &job : jobs) {
+    if (job.deadline.tv_sec == 0 || job.state == JOB_DONE)
+      continue;
+    if (nearest == nullptr || passed(job.deadline, *nearest))
+      nearest = &job.deadline;
+  }
+  return nearest;
+}
+
+/**
+ * @brief How long until the nearest deadline of a job that is not done, for
+ * loops that sleep on their own (run_parallel()'s ppoll(), read_input()).
+ * @return &left, or nullptr if no job has a deadline
+ */
+const struct timespec *JobTable::time_left(struct timespec &left) {
+  const struct timespec *nearest = nearest_deadline();
+  if (nearest == nullptr)
+    return nullptr;
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  left = {0, 0};
+  if (!passed(*nearest, now)) {
+    left.tv_sec = nearest->tv_sec - now.tv_sec;
+    left.tv_nsec = nearest->tv_nsec - now.tv_nsec;
+    if (left.tv_nsec < 0) {
+      left.tv_sec--;
+      left.tv_nsec += 1000000000L;
+    }
+  }
+  return &left;
+}
+
+static void watch(int epoll_fd, int fd) {
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.fd = fd;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+static void arm(int timer_fd, const struct timespec *deadline) {
+  struct itimerspec spec;
+  memset(&spec, 0, sizeof(spec));
+  if (deadline != nullptr)
+    spec.it_value = *deadline;  // otherwise all zero, which disarms it
+  timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+}
+
+/**
+ * @brief Runs the epoll loop of wait_for() until `job` is done or stopped.
+ * Called with SIGCHLD blocked, which keeps it blocked: children's exits
+ * arrive through pidfds (in whatever order they happen) and every other
+ * state change through the signalfd.
+ * @return false if the fds could not be set up, leaving `job` untouched
+ */
+bool JobTable::supervise(Job *job, const sigset_t &chld) {
+  int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  int signal_fd = signalfd(-1, &chld, SFD_NONBLOCK | SFD_CLOEXEC);
+  int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (epoll_fd == -1 || signal_fd == -1 || timer_fd == -1) {
+    for (int fd : {epoll_fd, signal_fd, timer_fd}) {
+      if (fd != -1)
+        close(fd);
+    }
+    return false;
+  }
+  watch(epoll_fd, signal_fd);
+  watch(epoll_fd, timer_fd);
+
+  // Unreaped children cannot be reused pids, so these are the job's own.
+  vector<pair<int, pid_t>> pidfds;
+  for (const ProcessStats &stats : job->stats) {
+    if (stats.done)
+      continue;
+    int fd = syscall(SYS_pidfd_open, stats.pid, 0);
+    if (fd != -1) {  // otherwise its exit still shows up on the signalfd
+      watch(epoll_fd, fd);
+      pidfds.push_back({fd, stats.pid});
+    }
+  }
+
+  struct epoll_event events[16];
+  while (job->state == JOB_RUNNING) {
+    // The nearest deadline of any job: background ones expire on time too.
+    arm(timer_fd, nearest_deadline());
+    int n = epoll_wait(epoll_fd, events, 16, -1);
+    for (int i = 0; i < n; i++) {
+      int fd = events[i].data.fd;
+      if (fd == signal_fd) {
+        struct signalfd_siginfo info;
+        while (read(signal_fd, &info, sizeof(info)) > 0) {
+        }
+        continue;
+      }
+      if (fd == timer_fd) {
+        uint64_t expirations;
+        read(timer_fd, &expirations, sizeof(expirations));
+        continue;  // update() below expires whichever job it was
+      }
+      for (auto it = pidfds.begin(); it != pidfds.end(); ++it) {
+        if (it->first != fd)
+          continue;
+        siginfo_t info;
+        struct rusage usage;
+        info.si_pid = 0;
+        if (syscall(SYS_waitid, P_PIDFD, fd, &info, WEXITED | WNOHANG,
+                    &usage) == 0 &&
+            info.si_pid != 0) {
+          struct timespec end;
+          clock_gettime(CLOCK_MONOTONIC, &end);
+          int status = info.si_code == CLD_EXITED ? info.si_status << 8
+                                                  : info.si_status;
+          apply(it->second, status, usage, end);
+        }
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        pidfds.erase(it);
+        break;
+      }
+    }
+    update();  // stops, continues, other jobs' children
+  }
+
+  for (const pair<int, pid_t> &pidfd : pidfds) close(pidfd.first);
+  close(timer_fd);
+  close(signal_fd);
+  close(epoll_fd);
+  return true;
+}
+
+/**
+ * @brief Waits until `job` is done or stopped, enforcing its deadline, with
+ * supervise()'s epoll loop; sigsuspend() is the fallback should that run out
+ * of fds. SIGCHLD stays blocked between checks so no wakeup is lost.
+ */
+void JobTable::wait_for(Job *job) {
+  sigset_t old, chld;
+  block_sigchld(&old);
+  update();
+  sigemptyset(&chld);
+  sigaddset(&chld, SIGCHLD);
+  if (job->state != JOB_RUNNING || !supervise(job, chld)) {
+    while (job->state == JOB_RUNNING) {
+      sigsuspend(&old);
+      update();
+    }
+  }
+  sigprocmask(SIG_SETMASK, &old, nullptr);
+}
+
+/**
+ * @brief Continues a job (if stopped) in the foreground or the background.
+ * In the foreground the job gets the terminal until it stops or finishes,
+ * its status becomes `$?`, and a finished job leaves the table.
+ */
+void JobTable::resume(Job *job, bool foreground) {
+  job->background = !foreground;
+  bool stopped = job->state == JOB_STOPPED;
+  if (foreground && job->pgid != 0)
+    tcsetpgrp(STDIN_FILENO, job->pgid);
+  if (stopped) {
+    job->state = JOB_RUNNING;
+    signal_job(job, SIGCONT);
+  }
+  if (!foreground)
+    return;
+
+  wait_for(job);
+  if (control)
+    tcsetpgrp(STDIN_FILENO, shell_pgid);
+  last_status() = job->status;
+  if (job->timed && job->state == JOB_DONE)
+    print_stats(stderr, job->stats);
+  if (job->state == JOB_STOPPED) {
+    job->background = true;
+    fprintf(stderr, "\n[%d]+  Stopped                 %s\n", job->id,
+            job->command.c_str());
+  } else {
+    remove(job);
+  }
+}
+
+/**
+ * @brief Waits for every running job, as `wait` with no arguments does.
+ */
+void JobTable::wait_all() {
+  update();
+  for (Job &job : jobs) {
+    if (job.state == JOB_RUNNING)
+      wait_for(&job);
+  }
+  notify(nullptr);
+}
+
+Job *JobTable::find(int id) {
+  for (Job &job : jobs) {
+    if (job.id == id)
+      return &job;
+  }
+  return nullptr;
+}
+
+Job *JobTable::find_pid(pid_t pid) {
+  for (Job &job : jobs) {
+    for (pid_t p : job.pids) {
+      if (p == pid)
+        return &job;
+    }
+  }
+  return nullptr;
+}
+
+/**
+ * @brief The job fg and bg act on without an argument: the newest one.
+ */
+Job *JobTable::current() { return jobs.empty() ? nullptr : &jobs.back(); }
+
+void JobTable::remove(Job *job) {
+  for (auto it = jobs.begin(); it != jobs.end(); ++it) {
+    if (&*it == job) {
+      jobs.erase(it);
+      return;
+    }
+  }
+}
+
+/**
+ * @brief Reports background jobs that have finished and forgets them. With a
+ * nullptr `out` they are forgotten silently, as scripts do.
+ */
+void JobTable::notify(FILE *out) {
+  update();
+  for (auto it = jobs.begin(); it != jobs.end();) {
+    if (it->state != JOB_DONE || !it->background) {
+      ++it;
+      continue;
+    }
+    if (out != nullptr) {
+      fprintf(out, "[%d]%c  %-24s%s\n", it->id, &*it == current() ? '+' : ' ',
+              it->status == 0 ? "Done" : "Exit", it->command.c_str());
+    }
+    it = jobs.erase(it);
+  }
+  if (out != nullptr)
+    fflush(out);
+}
+
+void JobTable::print(FILE *out) {
+  update();
+  for (Job &job : jobs) {
+    const char *state = job.state == JOB_RUNNING   ? "Running"
+                        : job.state == JOB_STOPPED ? "Stopped"
+                                                   : "Done";
+    fprintf(out, "[%d]%c  %-24s%s\n", job.id, &job == current() ? '+' : ' ',
+            state, job.command.c_str());
+  }
+  notify(nullptr);
+}
+
+/*** Builtins ***/
+
+/**
+ * @brief Resolves a job argument: %n or n is a job id, %% or no argument the
+ * current job. Reports and returns nullptr when there is no such job.
+ */
+Job *parse_job_spec(const char *builtin, const char *spec) {
+  JobTable &table = job_table();
+  table.update();
+  Job *job = nullptr;
+  if (spec == nullptr || strcmp(spec, "%%") == 0 || strcmp(spec, "%+") == 0) {
+    job = table.current();
+  } else {
+    char *end;
+    long id = strtol(spec[0] == '%' ? spec + 1 : spec, &end, 10);
+    if (*end == '\0')
+      job = table.find(id);
+  }
+  if (job == nullptr)
+    fprintf(stderr, "tsh: %s: %s: no such job\n", builtin,
+            spec == nullptr ? "current" : spec);
+  return job;
+}
+
+int jobs_builtin(char **) {
+  job_table().print(stdout);
+  return 0;
+}
+
+int fg_builtin(char **argv) {
+  Job *job = parse_job_spec("fg", argv[1]);
+  if (job == nullptr)
+    return 1;
+  printf("%s\n", job->command.c_str());
+  fflush(stdout);
+  job_table().resume(job, true);
+  return last_status();
+}
+
+static int bg_job(const char *spec) {
+  Job *job = parse_job_spec("bg", spec);
+  if (job == nullptr)
+    return 1;
+  job_table().resume(job, false);
+  printf("[%d]+ %s &\n", job->id, job->command.c_str());
+  return 0;
+}
+
+int bg_builtin(char **argv) {
+  if (argv[1] == nullptr)
+    return bg_job(nullptr);
+  int status = 0;
+  for (int i = 1; argv[i] != nullptr; i++) {
+    status |= bg_job(argv[i]);
+  }
+  return status;
+}
+
+/**
+ * @brief `wait` waits for every job; `wait %n|pid ...` for the given ones and
+ * returns the status of the last.
+ */
+int wait_builtin(char **argv) {
+  JobTable &table = job_table();
+  if (argv[1] == nullptr) {
+    table.wait_all();
+    return 0;
+  }
+
+  int status = 0;
+  for (int i = 1; argv[i] != nullptr; i++) {
+    Job *job = argv[i][0] == '%' ? parse_job_spec("wait", argv[i])
+                                 : table.find_pid(atoi(argv[i]));
+    if (job == nullptr) {
+      if (argv[i][0] != '%')
+        fprintf(stderr, "tsh: wait: pid %s is not a child of this shell\n",
+                argv[i]);
+      status = 127;
+      continue;
+    }
+    table.wait_for(job);
+    status = job->status;
+  }
+  table.notify(nullptr);
+  return status;
+}
@@ -0,0 +1,175 @@
+#include <launch.h>
+#include <errno.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zygote.h>
+
+static SpawnBackend current_backend = TSH_DEFAULT_SPAWN;
+static bool backend_initialized = false;
+
+/**
+ * @brief The backend in use. The build picks the default
+ * (-DTSH_DEFAULT_SPAWN=SPAWN_FORK, SPAWN_POSIX or SPAWN_ZYGOTE);
+ * TSH_SPAWN=fork, posix_spawn or zygote in the environment overrides it at
+ * startup.
+ */
+SpawnBackend spawn_backend() {
+  if (!backend_initialized) {
+    backend_initialized = true;
+    const char *env = getenv("TSH_SPAWN");
+    if (env != nullptr && strcmp(env, "fork") == 0) {
+      current_backend = SPAWN_FORK;
+    } else if (env != nullptr && strcmp(env, "posix_spawn") == 0) {
+      current_backend = SPAWN_POSIX;
+    } else if (env != nullptr && strcmp(env, "zygote") == 0) {
+      current_backend = SPAWN_ZYGOTE;
+    }
+  }
+  return current_backend;
+}
+
+void set_spawn_backend(SpawnBackend backend) {
+  backend_initialized = true;
+  current_backend = backend;
+}
+
+const char *spawn_backend_name(SpawnBackend backend) {
+  if (backend == SPAWN_ZYGOTE)
+    return "zygote";
+  return backend == SPAWN_FORK ? "fork" : "posix_spawn";
+}
+
+// Signals an interactive shell ignores or handles; children get them back at
+// their defaults, with nothing blocked.
+static const int child_default_signals[] = {SIGINT,  SIGQUIT, SIGTSTP,
+                                            SIGTTIN, SIGTTOU, SIGCHLD};
+
+/**
+ * @brief argv for running `path` as a /bin/sh script: /bin/sh, path, then
+ * argv[1] on. execvp() retries this way when the kernel refuses a file with
+ * ENOEXEC (a script without a #! line); running the resolved path with
+ * execv()/posix_spawn() has to do it by hand.
+ */
+std::vector<char *> script_argv(const char *path, char **argv) {
+  std::vector<char *> script = {(char *)"/bin/sh", (char *)path};
+  for (int i = 1; argv[i] != nullptr; i++) {
+    script.push_back(argv[i]);
+  }
+  script.push_back(nullptr);
+  return script;
+}
+
+static pid_t launch_fork(const LaunchSpec &spec) {
+  // Anything still buffered would otherwise be written twice.
+  fflush(stdout);
+  fflush(stderr);
+  pid_t pid = fork();
+  if (pid != 0) {
+    return pid;
+  }
+
+  for (int sig : child_default_signals) {
+    signal(sig, SIG_DFL);
+  }
+  sigset_t none;
+  sigemptyset(&none);
+  sigprocmask(SIG_SETMASK, &none, nullptr);
+  if (spec.pgid >= 0) {
+    setpgid(0, spec.pgid);
+  }
+
+  for (const FdAction &action : spec.actions) {
+    if (action.kind == FdAction::DUP2) {
+      dup2(action.src_fd, action.fd);
+    } else if (action.kind == FdAction::CLOSE) {
+      close(action.fd);
+    } else {
+      tcsetpgrp(action.fd, getpgrp());
+    }
+  }
+  if (spec.builtin != nullptr) {
+    int status = spec.builtin(spec.argv);
+    fflush(stdout);
+    _exit(status);
+  }
+  execv(spec.path, spec.argv);
+  if (errno == ENOEXEC) {
+    std::vector<char *> script = script_argv(spec.path, spec.argv);
+    execv(script[0], script.data());
+  }
+  perror("execve failed");
+  _exit(126);
+}
+
+static pid_t launch_posix(const LaunchSpec &spec) {
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  for (const FdAction &action : spec.actions) {
+    if (action.kind == FdAction::DUP2) {
+      posix_spawn_file_actions_adddup2(&actions, action.src_fd, action.fd);
+    } else if (action.kind == FdAction::CLOSE) {
+      posix_spawn_file_actions_addclose(&actions, action.fd);
+    } else {
+#if __GLIBC_PREREQ(2, 35)
+      posix_spawn_file_actions_addtcsetpgrp_np(&actions, action.fd);
+#endif
+      // Older glibc: the shell's own tcsetpgrp() after the launch has to do.
+    }
+  }
+
+  posix_spawnattr_t attr;
+  posix_spawnattr_init(&attr);
+  short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+  sigset_t defaults, none;
+  sigemptyset(&defaults);
+  for (int sig : child_default_signals) {
+    sigaddset(&defaults, sig);
+  }
+  sigemptyset(&none);
+  posix_spawnattr_setsigdefault(&attr, &defaults);
+  posix_spawnattr_setsigmask(&attr, &none);
+  if (spec.pgid >= 0) {
+    flags |= POSIX_SPAWN_SETPGROUP;
+    posix_spawnattr_setpgroup(&attr, spec.pgid);
+  }
+  posix_spawnattr_setflags(&attr, flags);
+
+  pid_t pid;
+  int err = posix_spawn(&pid, spec.path, &actions, &attr, spec.argv, environ);
+  if (err == ENOEXEC) {
+    std::vector<char *> script = script_argv(spec.path, spec.argv);
+    err = posix_spawn(&pid, script[0], &actions, &attr, script.data(), environ);
+  }
+  posix_spawnattr_destroy(&attr);
+  posix_spawn_file_actions_destroy(&actions);
+  if (err != 0) {
+    errno = err;
+    perror("posix_spawn failed");
+    return -1;
+  }
+  return pid;
+}
+
+/**
+ * @brief Starts spec.path (or spec.builtin) with spec.argv after applying
+ * spec.actions in the child. The child joins process group spec.pgid if it is
+ * not -1, and starts with the shell's job control signals at their defaults
+ * and an empty signal mask.
+ *
+ * @return the child's pid, or -1 if it could not be started
+ */
+pid_t launch(const LaunchSpec &spec) {
+  if (spec.builtin != nullptr || spawn_backend() == SPAWN_FORK) {
+    return launch_fork(spec);
+  }
+  if (spawn_backend() == SPAWN_ZYGOTE) {
+    pid_t pid = zygote().launch(spec);
+    if (pid != -2)
+      return pid;
+  }
+  return launch_posix(spec);
+}
@@ -1,11 +1,32 @@
 #include <tsh.h>
 
 /**
- * @brief the main runner, nothing to do here.
+ * @brief the main runner.
  *
- * @return int
+ *   tsh_app                interactive; prompts only if stdin is a terminal
+ *   tsh_app script.sh      runs the script file
+ *   tsh_app -c 'commands'  runs the given command line(s)
+ *   tsh_app --server path  serves command lines on a Unix socket (tsh_client)
+ *
+ * @return int the exit status of the last pipeline (or the `exit` argument)
  */
-int main() {
-  run();
-  exit(0);
+int main(int argc, char **argv) {
+  if (argc > 2 && strcmp(argv[1], "--server") == 0)
+    exit(run_server(argv[2]));
+
+  // Fork the zygote while the shell is still small.
+  if (spawn_backend() == SPAWN_ZYGOTE)
+    zygote().start();
+
+  if (argc > 2 && strcmp(argv[1], "-c") == 0) {
+    interactive() = false;
+    run_lines(argv[2], strlen(argv[2]));
+  } else if (argc > 1) {
+    interactive() = false;
+    exit(run_script(argv[1]));
+  } else {
+    interactive() = isatty(STDIN_FILENO);
+    run();
+  }
+  exit(last_status());
 }
\ No newline at end of file
@@ -0,0 +1,181 @@
+#include <poll.h>
+#include <signal.h>
+#include <tsh.h>
+#include <string>
+
+using namespace std;
+
+/**
+ * @brief Settings '&&&' groups use; `parallel -j N`, `-b` and `-u` change them.
+ */
+ParallelSettings &parallel_settings() {
+  static ParallelSettings settings = {0, false};
+  return settings;
+}
+
+// One running pipeline of a parallel run.
+struct ParallelSlot {
+  Job *job;
+  int out_fd;     // read end of the job's stdout when buffering, else -1
+  string output;  // what the job has written so far
+};
+
+static bool slot_finished(const ParallelSlot &slot) {
+  return slot.out_fd == -1 &&
+         (slot.job->pids.empty() || slot.job->state == JOB_DONE);
+}
+
+/**
+ * @brief Runs `pipelines` with at most settings.slots of them alive at once,
+ * starting the next one as soon as any finishes.
+ *
+ * Jobs are started through launch_pipeline(), so they use the same spawn path
+ * as everything else, and stay in the shell's process group so Ctrl-C reaches
+ * all of them. Completions come from the SIGCHLD-driven job table. SIGCHLD is
+ * kept blocked except inside ppoll(), which therefore wakes up both for
+ * buffered output and for children changing state without losing either.
+ *
+ * @return the number of pipelines that failed, capped at 101 (as GNU
+ * parallel reports it); also stored in last_status()
+ */
+int run_parallel(const vector<vector<Process *>> &pipelines,
+                 const ParallelSettings &settings) {
+  JobTable &jobs = job_table();
+  size_t slots = settings.slots > 0 ? settings.slots
+                                    : sysconf(_SC_NPROCESSORS_ONLN);
+  vector<ParallelSlot> running;
+  vector<struct pollfd> pfds;
+  size_t next = 0;
+  int failed = 0;
+
+  sigset_t chld, old;
+  sigemptyset(&chld);
+  sigaddset(&chld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &chld, &old);
+
+  while (next < pipelines.size() || !running.empty()) {
+    while (running.size() < slots && next < pipelines.size()) {
+      int fds[2] = {-1, -1};
+      if (settings.buffer) {
+        pipe2(fds, O_CLOEXEC);
+      }
+      Job *job = launch_pipeline(pipelines[next++], fds[1], false);
+      if (fds[1] != -1) {
+        close(fds[1]);
+      }
+      running.push_back({job, fds[0], string()});
+    }
+
+    jobs.update();
+    bool progress = false;
+    for (size_t i = 0; i < running.size();) {
+      if (!slot_finished(running[i])) {
+        i++;
+        continue;
+      }
+      ParallelSlot &slot = running[i];
+      if (!slot.output.empty()) {
+        fwrite(slot.output.data(), 1, slot.output.size(), stdout);
+        fflush(stdout);
+      }
+      failed += slot.job->status != 0;
+      jobs.remove(slot.job);
+      running.erase(running.begin() + i);
+      progress = true;
+    }
+    if (progress || running.empty())
+      continue;
+
+    pfds.clear();
+    for (ParallelSlot &slot : running) {
+      if (slot.out_fd != -1)
+        pfds.push_back({slot.out_fd, POLLIN, 0});
+    }
+    struct timespec left;
+    if (ppoll(pfds.data(), pfds.size(), jobs.time_left(left), &old) <= 0)
+      continue;  // SIGCHLD or a deadline: the next update() acts on it
+
+    char buf[65536];
+    for (ParallelSlot &slot : running) {
+      if (slot.out_fd == -1)
+        continue;
+      for (struct pollfd &pfd : pfds) {
+        if (pfd.fd != slot.out_fd || pfd.revents == 0)
+          continue;
+        ssize_t n = read(slot.out_fd, buf, sizeof(buf));
+        if (n > 0) {
+          slot.output.append(buf, n);
+        } else if (n == 0 || errno != EINTR) {
+          close(slot.out_fd);
+          slot.out_fd = -1;
+        }
+      }
+    }
+  }
+
+  sigprocmask(SIG_SETMASK, &old, nullptr);
+  last_status() = failed > 101 ? 101 : failed;
+  return last_status();
+}
+
+static void parallel_usage() {
+  fprintf(stderr,
+          "usage: parallel [-j N] [-b|-u] [command [args] ::: value ...]\n");
+}
+
+/**
+ * @brief parallel [-j N] [-b|-u] [command [args] ::: value ...]
+ *
+ * Without a command the options become the defaults for '&&&' groups. With
+ * one, `command args value` runs for every value after ':::', on the given
+ * number of slots (one per CPU by default). -b buffers each job's output,
+ * -u writes it straight through (the default).
+ */
+int parallel_builtin(char **argv) {
+  ParallelSettings settings = parallel_settings();
+  int i = 1;
+  for (; argv[i] != nullptr && argv[i][0] == '-'; i++) {
+    if (strcmp(argv[i], "-b") == 0) {
+      settings.buffer = true;
+    } else if (strcmp(argv[i], "-u") == 0) {
+      settings.buffer = false;
+    } else if (strncmp(argv[i], "-j", 2) == 0) {
+      const char *count = argv[i][2] != '\0' ? argv[i] + 2 : argv[++i];
+      char *end;
+      settings.slots = count == nullptr ? -1 : strtol(count, &end, 10);
+      if (count == nullptr || *end != '\0' || settings.slots < 0) {
+        parallel_usage();
+        return 2;
+      }
+    } else {
+      parallel_usage();
+      return 2;
+    }
+  }
+
+  if (argv[i] == nullptr) {
+    parallel_settings() = settings;
+    return 0;
+  }
+
+  int separator = i;
+  while (argv[separator] != nullptr && strcmp(argv[separator], ":::") != 0)
+    separator++;
+  if (argv[separator] == nullptr || separator == i) {
+    parallel_usage();
+    return 2;
+  }
+
+  Arena &arena = line_arena();
+  vector<vector<Process *>> pipelines;
+  for (int v = separator + 1; argv[v] != nullptr; v++) {
+    Process *p = arena.make<Process>(false, false, &arena);
+    for (int t = i; t < separator; t++) {
+      p->add_token(argv[t]);
+    }
+    p->add_token(argv[v]);
+    p->add_token(nullptr);
+    pipelines.push_back({p});
+  }
+  return run_parallel(pipelines, settings);
+}
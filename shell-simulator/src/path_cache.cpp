@@ -0,0 +1,136 @@
+#include <path_cache.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+/**
+ * @brief The command hash table shared by the whole shell.
+ */
+PathCache &path_cache() {
+  static PathCache cache;
+  return cache;
+}
+
+static bool is_executable(const string &path) {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode) &&
+         access(path.c_str(), X_OK) == 0;
+}
+
+/**
+ * @brief Walks PATH the way execvp() would and returns the first executable
+ * match. An empty PATH component means the current directory.
+ */
+bool PathCache::search(const char *name, string &path) const {
+  const char *dirs = path_var.c_str();
+  while (true) {
+    const char *end = strchr(dirs, ':');
+    size_t len = end ? (size_t)(end - dirs) : strlen(dirs);
+    string candidate = len == 0 ? string(".") : string(dirs, len);
+    candidate += '/';
+    candidate += name;
+    if (is_executable(candidate)) {
+      path = candidate;
+      return true;
+    }
+    if (end == nullptr)
+      return false;
+    dirs = end + 1;
+  }
+}
+
+/**
+ * @brief Resolves a command name to the path execve() should run.
+ *
+ * Names containing a '/' are used as they are. Everything else is looked up
+ * in the table first and searched for on PATH on a miss.
+ *
+ * @param name the command name (argv[0])
+ * @param path set to the resolved path on success
+ * @return false if the command cannot be found
+ */
+bool PathCache::lookup(const char *name, string &path) {
+  if (strchr(name, '/') != nullptr) {
+    path = name;
+    return true;
+  }
+
+  const char *current = getenv("PATH");
+  if (current == nullptr)
+    current = "/usr/local/bin:/usr/bin:/bin";
+  if (path_var != current) {
+    table.clear();
+    path_var = current;
+  }
+
+  auto it = table.find(name);
+  if (it != table.end()) {
+    if (is_executable(it->second.path)) {
+      it->second.hits++;
+      path = it->second.path;
+      return true;
+    }
+    table.erase(it);  // the cached file disappeared; search again
+  }
+
+  if (!search(name, path))
+    return false;
+  table[name] = Entry{path, 1};
+  return true;
+}
+
+/**
+ * @brief Forgets every remembered location (hash -r).
+ */
+void PathCache::forget() { table.clear(); }
+
+/**
+ * @brief Prints the table in the same layout as bash's `hash`.
+ */
+void PathCache::print(FILE *out) const {
+  if (table.empty()) {
+    fprintf(out, "hash: hash table empty\n");
+    return;
+  }
+  fprintf(out, "hits\tcommand\n");
+  for (const auto &entry : table) {
+    fprintf(out, "%4d\t%s\n", entry.second.hits, entry.second.path.c_str());
+  }
+}
+
+/**
+ * @brief The `hash` builtin.
+ *
+ *   hash          print the remembered commands
+ *   hash -r       forget them all
+ *   hash name...  look the names up and remember them
+ *
+ * @param argv nullptr-terminated argument list, argv[0] is "hash"
+ * @return the exit status
+ */
+int hash_builtin(char **argv) {
+  PathCache &cache = path_cache();
+  if (argv[1] == nullptr) {
+    cache.print(stdout);
+    fflush(stdout);
+    return 0;
+  }
+
+  int status = 0;
+  for (int i = 1; argv[i] != nullptr; i++) {
+    if (strcmp(argv[i], "-r") == 0) {
+      cache.forget();
+      continue;
+    }
+    string path;
+    if (!cache.lookup(argv[i], path)) {
+      fprintf(stderr, "tsh: hash: %s: not found\n", argv[i]);
+      status = 1;
+    }
+  }
+  return status;
+}
@@ -0,0 +1,445 @@
+#include <tsh.h>
+#include <memory>
+#include <string>
+
+using namespace std;
+
+/*** Syntax tree ***/
+
+struct Node;
+typedef vector<Node *> NodeList;
+
+/**
+ * @brief One command of a block: a command list as parse_input() left it,
+ * or a compound command over further lists.
+ */
+struct Node {
+  enum Kind { COMMANDS, FOR, WHILE, UNTIL, IF } kind;
+  list<Process *> commands;  // COMMANDS
+  const char *name;          // FOR: the loop variable
+  vector<char *> words;      // FOR: its values, expanded on every run
+  NodeList condition;        // WHILE, UNTIL, IF
+  NodeList body;             // FOR, WHILE, UNTIL; IF: the then part
+  NodeList otherwise;        // IF: the else part; an elif is an IF in it
+};
+
+static const char *const opening[] = {"for", "while", "until", "if", nullptr};
+static const char *const closing[] = {"done", "fi", nullptr};
+// Keywords after which a new command starts.
+static const char *const leading[] = {"while", "until", "if",   "then",
+                                      "elif",  "else",  "do",   nullptr};
+static const char *const reserved[] = {"then", "elif", "else", "fi",
+                                       "do",   "done", nullptr};
+
+static size_t word_length(const char *c, const char *end) {
+  const char *w = c;
+  while (w < end && *w != ' ' && *w != '\t' && *w != '\n' && *w != ';' &&
+         *w != '\0')
+    w++;
+  return w - c;
+}
+
+static bool is_one_of(const char *word, size_t length,
+                      const char *const *keywords) {
+  for (; *keywords != nullptr; keywords++) {
+    if (length == strlen(*keywords) && memcmp(word, *keywords, length) == 0)
+      return true;
+  }
+  return false;
+}
+
+/**
+ * @brief How many blocks [begin, end) opens (for/while/until/if) minus how
+ * many it closes (done/fi), counting keywords only where a command starts.
+ * Sets `compound` if there is any keyword at all, i.e. the text needs
+ * run_block() rather than plain parse_input().
+ */
+int block_depth(const char *begin, const char *end, bool &compound) {
+  int depth = 0;
+  bool command_start = true;
+  for (const char *c = begin; c < end;) {
+    if (*c == ' ' || *c == '\t') {
+      c++;
+      continue;
+    }
+    if (*c == '\n' || *c == ';') {
+      command_start = true;
+      c++;
+      continue;
+    }
+    if (command_start && *c == '#') {  // a comment, up to the end of the line
+      const char *newline = (const char *)memchr(c, '\n', end - c);
+      c = newline != nullptr ? newline : end;
+      continue;
+    }
+    size_t length = word_length(c, end);
+    if (length == 0)
+      break;  // '\0'
+    bool keyword = command_start && (is_one_of(c, length, opening) ||
+                                     is_one_of(c, length, reserved));
+    if (keyword) {
+      compound = true;
+      depth += is_one_of(c, length, opening) - is_one_of(c, length, closing);
+    }
+    command_start = keyword && is_one_of(c, length, leading);
+    c += length;
+  }
+  return depth;
+}
+
+/*** Parser ***/
+
+/**
+ * @brief Recursive descent over the commands of a block. The text is split
+ * in place into commands at ';' and newlines; each keyword is taken off the
+ * front of its command, and what is left of a command that is not a
+ * keyword goes to parse_input().
+ */
+class Parser {
+ public:
+  Parser(char *text, Arena &arena, vector<unique_ptr<Node>> &nodes)
+      : cursor(text), current(nullptr), arena(arena), nodes(nodes),
+        failed(false) {}
+
+  bool parse(NodeList &top) {
+    static const char *const none[] = {nullptr};
+    return parse_list(top, none) && !failed;
+  }
+
+ private:
+  char *command();
+  bool at(const char *keyword);
+  void take(const char *keyword);
+  bool expect(const char *keyword);
+  bool end_compound();
+  char *next_word();
+  void error(const char *near);
+  Node *make(Node::Kind kind);
+  bool parse_list(NodeList &list, const char *const *terminators);
+  Node *parse_command();
+  Node *parse_loop(Node::Kind kind, const char *keyword);
+  Node *parse_for();
+  Node *parse_if();
+
+  char *cursor;   // text not yet split into commands
+  char *current;  // what is left of the current command
+  Arena &arena;
+  vector<unique_ptr<Node>> &nodes;
+  bool failed;
+};
+
+/**
+ * @brief The rest of the current command, moving on to the next one once it
+ * is used up; nullptr at the end of the text. Comments are skipped.
+ */
+char *Parser::command() {
+  while (true) {
+    if (current != nullptr) {
+      current += strspn(current, " \t");
+      if (*current != '\0')
+        return current;
+    }
+    if (*cursor == '\0')
+      return current = nullptr;
+    char *start = cursor + strspn(cursor, " \t");
+    cursor += strcspn(cursor, ";\n");
+    char separator = *cursor;
+    if (separator != '\0')
+      *cursor++ = '\0';
+    if (*start == '#') {
+      if (separator == ';')
+        cursor += strcspn(cursor, "\n");
+      current = nullptr;
+      continue;
+    }
+    current = start;
+  }
+}
+
+bool Parser::at(const char *keyword) {
+  char *c = command();
+  const char *keywords[] = {keyword, nullptr};
+  return c != nullptr && is_one_of(c, word_length(c, c + strlen(c)), keywords);
+}
+
+void Parser::take(const char *keyword) { current += strlen(keyword); }
+
+bool Parser::expect(const char *keyword) {
+  if (!at(keyword)) {
+    error(current);
+    return false;
+  }
+  take(keyword);
+  return true;
+}
+
+// After done or fi: nothing may follow on the same command.
+bool Parser::end_compound() {
+  current += strspn(current, " \t");
+  if (*current != '\0') {
+    error(current);
+    return false;
+  }
+  return true;
+}
+
+// Splits the next blank-separated word off the current command.
+char *Parser::next_word() {
+  char *word = current + strspn(current, " \t");
+  if (*word == '\0')
+    return nullptr;
+  current = word + strcspn(word, " \t");
+  if (*current != '\0')
+    *current++ = '\0';
+  return word;
+}
+
+void Parser::error(const char *near) {
+  if (!failed && near == nullptr) {
+    fprintf(stderr, "tsh: syntax error: unexpected end of file\n");
+  } else if (!failed) {
+    string token(near, word_length(near, near + strlen(near)));
+    fprintf(stderr, "tsh: syntax error near unexpected token `%s'\n",
+            token.c_str());
+  }
+  failed = true;
+}
+
+Node *Parser::make(Node::Kind kind) {
+  nodes.emplace_back(new Node());
+  nodes.back()->kind = kind;
+  nodes.back()->name = nullptr;
+  return nodes.back().get();
+}
+
+/**
+ * @brief Parses commands into `list` up to (not including) one of the
+ * `terminators`, or to the end of the text if there are none.
+ */
+bool Parser::parse_list(NodeList &list, const char *const *terminators) {
+  while (command() != nullptr) {
+    for (const char *const *t = terminators; *t != nullptr; t++) {
+      if (at(*t))
+        return true;
+    }
+    if (is_one_of(current, word_length(current, current + strlen(current)),
+                  reserved)) {
+      error(current);
+      return false;
+    }
+    Node *node = parse_command();
+    if (node == nullptr)
+      return false;
+    list.push_back(node);
+  }
+  if (terminators[0] != nullptr) {
+    error(nullptr);
+    return false;
+  }
+  return true;
+}
+
+Node *Parser::parse_command() {
+  if (at("for"))
+    return parse_for();
+  if (at("while"))
+    return parse_loop(Node::WHILE, "while");
+  if (at("until"))
+    return parse_loop(Node::UNTIL, "until");
+  if (at("if"))
+    return parse_if();
+  Node *node = make(Node::COMMANDS);
+  parse_input(current, node->commands, arena);
+  current += strlen(current);
+  return node;
+}
+
+// for NAME [in words...]; do list; done
+Node *Parser::parse_for() {
+  static const char *const done[] = {"done", nullptr};
+  Node *node = make(Node::FOR);
+  take("for");
+  node->name = next_word();
+  if (node->name == nullptr || is_assignment(node->name) ||
+      (!isalpha(*node->name) && *node->name != '_')) {
+    error(node->name == nullptr ? "for" : node->name);
+    return nullptr;
+  }
+  char *in = next_word();
+  if (in != nullptr && strcmp(in, "in") != 0) {
+    error(in);
+    return nullptr;
+  }
+  for (char *word; in != nullptr && (word = next_word()) != nullptr;)
+    node->words.push_back(word);
+  if (!expect("do") || !parse_list(node->body, done) || !expect("done") ||
+      !end_compound())
+    return nullptr;
+  return node;
+}
+
+// while|until list; do list; done
+Node *Parser::parse_loop(Node::Kind kind, const char *keyword) {
+  static const char *const do_[] = {"do", nullptr};
+  static const char *const done[] = {"done", nullptr};
+  Node *node = make(kind);
+  take(keyword);
+  if (!parse_list(node->condition, do_))
+    return nullptr;
+  if (node->condition.empty()) {
+    error(current);
+    return nullptr;
+  }
+  if (!expect("do") || !parse_list(node->body, done) || !expect("done") ||
+      !end_compound())
+    return nullptr;
+  return node;
+}
+
+// if list; then list; [elif list; then list;]... [else list;] fi
+Node *Parser::parse_if() {
+  static const char *const then[] = {"then", nullptr};
+  static const char *const branches[] = {"elif", "else", "fi", nullptr};
+  static const char *const fi[] = {"fi", nullptr};
+  Node *node = make(Node::IF);
+  take(at("if") ? "if" : "elif");
+  if (!parse_list(node->condition, then))
+    return nullptr;
+  if (node->condition.empty()) {
+    error(current);
+    return nullptr;
+  }
+  if (!expect("then") || !parse_list(node->body, branches))
+    return nullptr;
+  if (at("elif")) {  // the nested if takes the fi
+    Node *elif = parse_if();
+    if (elif == nullptr)
+      return nullptr;
+    node->otherwise.push_back(elif);
+    return node;
+  }
+  if (at("else")) {
+    take("else");
+    if (!parse_list(node->otherwise, fi))
+      return nullptr;
+  }
+  if (!expect("fi") || !end_compound())
+    return nullptr;
+  return node;
+}
+
+/*** Execution ***/
+
+// A command killed by Ctrl-C ends the loop running it, as in bash.
+static bool interrupted() { return last_status() == 128 + SIGINT; }
+
+/**
+ * @brief A copy of `p` in `arena` for one run: run_commands() expands and
+ * rewrites the token array, so the parsed one must stay untouched.
+ */
+static Process *copy_process(const Process *p, Arena &arena) {
+  Process *copy = arena.make<Process>(p->pipe_in, p->pipe_out, &arena);
+  copy->background = p->background;
+  copy->parallel = p->parallel;
+  copy->and_then = p->and_then;
+  copy->or_else = p->or_else;
+  for (int i = 0; i < p->tok_index; i++)
+    copy->add_token(p->cmdTokens[i]);
+  for (int i = 0; i < p->redirect_count; i++)
+    copy->add_redirect(p->redirects[i]);
+  return copy;
+}
+
+static bool run_list(const NodeList &list);
+
+/**
+ * @brief Runs one node. `$?` ends up as in sh: the last command run in a
+ * loop body, or 0 if none ran; the branch taken by an if, or 0.
+ *
+ * @return true if quit or exit ran
+ */
+static bool run_node(const Node *node) {
+  if (node->kind == Node::COMMANDS) {
+    list<Process *> commands;
+    for (const Process *p : node->commands)
+      commands.push_back(copy_process(p, line_arena()));
+    bool quit = run_commands(commands);
+    cleanup(commands, nullptr);
+    return quit;
+  }
+
+  if (node->kind == Node::FOR) {
+    vector<string> values;
+    for (char *word : node->words)
+      expand_fields(word, values);
+    last_status() = 0;
+    for (const string &value : values) {
+      set_variable(node->name, strlen(node->name), value.c_str());
+      if (run_list(node->body))
+        return true;
+      if (interrupted())
+        break;
+    }
+    return false;
+  }
+
+  if (node->kind == Node::IF) {
+    if (run_list(node->condition))
+      return true;
+    if (interrupted())
+      return false;
+    if (last_status() == 0)
+      return run_list(node->body);
+    last_status() = 0;
+    return run_list(node->otherwise);
+  }
+
+  int status = 0;  // WHILE, UNTIL
+  while (true) {
+    if (run_list(node->condition))
+      return true;
+    if (interrupted())
+      return false;
+    if ((last_status() == 0) == (node->kind == Node::UNTIL))
+      break;
+    if (run_list(node->body))
+      return true;
+    status = last_status();
+    if (interrupted())
+      return false;
+  }
+  last_status() = status;
+  return false;
+}
+
+static bool run_list(const NodeList &list) {
+  for (const Node *node : list) {
+    if (run_node(node))
+      return true;
+  }
+  return false;
+}
+
+/**
+ * @brief Parses the NUL-terminated `text` (split in place, so it must
+ * outlive the call) into a tree and runs it. Nothing runs if there is a
+ * syntax error; `$?` is then 2.
+ *
+ * @return true if quit or exit ran
+ */
+bool run_block(char *text) {
+  Arena arena(4096);
+  vector<unique_ptr<Node>> nodes;
+  NodeList top;
+  bool quit = false;
+  if (Parser(text, arena, nodes).parse(top)) {
+    quit = run_list(top);
+  } else {
+    last_status() = 2;
+  }
+  for (const unique_ptr<Node> &node : nodes) {
+    for (Process *p : node->commands)
+      p->~Process();
+  }
+  return quit;
+}
@@ -0,0 +1,508 @@
+#include <server.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <tsh.h>
+#include <unordered_map>
+
+using namespace std;
+
+/*** Framing ***/
+
+ssize_t FrameReader::fill() {
+  if (malformed) {
+    errno = EPROTO;
+    return -1;
+  }
+  if (start > 0 && start == buffer.size()) {
+    buffer.clear();
+    start = 0;
+  } else if (start > (1 << 16)) {
+    buffer.erase(0, start);
+    start = 0;
+  }
+  size_t used = buffer.size();
+  buffer.resize(used + (1 << 16));
+  ssize_t n;
+  do {
+    n = read(fd, &buffer[used], 1 << 16);
+  } while (n == -1 && errno == EINTR);
+  buffer.resize(used + (n > 0 ? n : 0));
+  return n;
+}
+
+bool FrameReader::next(FrameHeader &header, string &payload) {
+  if (buffer.size() - start < sizeof(header))
+    return false;
+  memcpy(&header, &buffer[start], sizeof(header));
+  if (header.length > MAX_FRAME_PAYLOAD) {
+    malformed = true;  // rejected before any of its payload is buffered
+    return false;
+  }
+  if (buffer.size() - start - sizeof(header) < header.length)
+    return false;
+  payload.assign(buffer, start + sizeof(header), header.length);
+  start += sizeof(header) + header.length;
+  return true;
+}
+
+void append_frame(string &out, uint32_t type, uint32_t id, const void *data,
+                  uint32_t length) {
+  FrameHeader header = {type, id, length};
+  out.append((const char *)&header, sizeof(header));
+  out.append((const char *)data, length);
+}
+
+static bool write_all(int fd, const char *data, size_t count) {
+  while (count > 0) {
+    ssize_t n = write(fd, data, count);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    data += n;
+    count -= n;
+  }
+  return true;
+}
+
+/**
+ * @brief Sends one frame on a blocking socket.
+ */
+bool write_frame(int fd, uint32_t type, uint32_t id, const void *data,
+                 uint32_t length) {
+  string frame;
+  append_frame(frame, type, id, data, length);
+  return write_all(fd, frame.data(), frame.size());
+}
+
+/**
+ * @brief Reads the next frame from a blocking socket.
+ * @return false at end of stream, on error or on an oversized frame
+ */
+bool read_frame(FrameReader &reader, FrameHeader &header, string &payload) {
+  while (!reader.next(header, payload)) {
+    if (reader.fill() <= 0)
+      return false;
+  }
+  return true;
+}
+
+static bool socket_address(const char *socket_path, struct sockaddr_un &addr) {
+  if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "tsh: socket path too long: %s\n", socket_path);
+    return false;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, socket_path);
+  return true;
+}
+
+/**
+ * @brief Connects to a tsh daemon.
+ * @return the connected socket, or -1 with errno set
+ */
+int connect_server(const char *socket_path) {
+  struct sockaddr_un addr;
+  if (!socket_address(socket_path, addr))
+    return -1;
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1)
+    return -1;
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return -1;
+  }
+  return fd;
+}
+
+/*** Daemon ***/
+
+static const uint32_t READABLE = EPOLLIN;
+static const uint32_t WRITABLE = EPOLLOUT;
+
+// Output beyond this much queued for a client pauses its requests' pipes.
+#define CLIENT_OUTPUT_LIMIT (4 << 20)
+
+struct Connection;
+
+// What an epoll event refers to.
+struct Watch {
+  enum Kind { LISTEN, SIGNALS, CLIENT, OUTPUT } kind;
+  Connection *conn;
+  struct Request *request;
+  uint32_t frame;  // FRAME_STDOUT or FRAME_STDERR for OUTPUT
+  int fd;
+};
+
+// One command line being run for a client.
+struct Request {
+  uint32_t id;
+  pid_t pid;
+  int status;  // `$?` of the runner once it has exited, else -1
+  Watch out;   // read ends of the runner's stdout and stderr; fd -1 at EOF
+  Watch err;
+};
+
+struct Connection {
+  Watch watch;
+  FrameReader reader;
+  string output;      // frames not yet written to the client
+  size_t output_pos;  // first unwritten byte of output
+  uint32_t events;    // what the socket is registered for
+  bool paused;        // request pipes are out of the epoll set
+  bool read_closed;   // the client shut down its side, or sent a bad frame
+  bool broken;        // the client is gone; drop output, reap and close
+  bool closed;        // socket closed, freed after the current epoll batch
+  unordered_map<uint32_t, Request *> requests;
+
+  explicit Connection(int fd) : reader(fd) {}
+};
+
+/**
+ * @brief The daemon's state: one epoll set for the listening socket, a
+ * signalfd for SIGCHLD, every client and every runner's output pipes.
+ */
+struct Daemon {
+  int epoll_fd;
+  Watch listen;
+  Watch signals;
+  unordered_map<pid_t, pair<Connection *, Request *>> runners;
+  vector<Connection *> closed;  // to free once no event can refer to them
+  sigset_t old_mask;
+};
+
+static void watch_fd(Daemon &daemon, Watch *watch, uint32_t events, int op) {
+  struct epoll_event event;
+  event.events = events;
+  event.data.ptr = watch;
+  epoll_ctl(daemon.epoll_fd, op, watch->fd, &event);
+}
+
+/**
+ * @brief Runs one request in a forked copy of the daemon: its stdout and
+ * stderr are the given pipes, stdin is /dev/null, and the line goes through
+ * run_lines() exactly as `tsh -c` would run it, without exec'ing a new
+ * shell. The runner leads its own process group so a vanished client's
+ * pipelines can be killed as a whole.
+ */
+static pid_t start_runner(Daemon &daemon, string &line, int out_fd,
+                          int err_fd) {
+  pid_t pid = fork();
+  if (pid != 0)
+    return pid;
+
+  setpgid(0, 0);
+  signal(SIGPIPE, SIG_DFL);
+  sigprocmask(SIG_SETMASK, &daemon.old_mask, nullptr);
+  int null_fd = open("/dev/null", O_RDONLY);
+  dup2(null_fd, STDIN_FILENO);
+  dup2(out_fd, STDOUT_FILENO);
+  dup2(err_fd, STDERR_FILENO);
+  close_range(3, ~0U, 0);
+
+  interactive() = false;
+  run_lines(&line[0], line.size());
+  fflush(stdout);
+  fflush(stderr);
+  _exit(last_status());
+}
+
+static void set_paused(Daemon &daemon, Connection *conn, bool paused) {
+  if (conn->paused == paused)
+    return;
+  conn->paused = paused;
+  for (auto &entry : conn->requests) {
+    Watch *streams[] = {&entry.second->out, &entry.second->err};
+    for (Watch *stream : streams) {
+      if (stream->fd != -1)
+        watch_fd(daemon, stream, paused ? 0 : READABLE, EPOLL_CTL_MOD);
+    }
+  }
+}
+
+static void close_connection(Daemon &daemon, Connection *conn) {
+  if (!conn->broken)
+    epoll_ctl(daemon.epoll_fd, EPOLL_CTL_DEL, conn->watch.fd, nullptr);
+  close(conn->watch.fd);
+  conn->closed = true;
+  daemon.closed.push_back(conn);
+}
+
+/**
+ * @brief Gives up on a client that hung up or failed: its socket leaves the
+ * epoll set (a hung up socket would report EPOLLHUP forever), its queued
+ * output is dropped and its runners are sent SIGHUP. The connection is
+ * closed once they are all reaped.
+ */
+static void mark_broken(Daemon &daemon, Connection *conn) {
+  if (conn->broken)
+    return;
+  conn->broken = true;
+  epoll_ctl(daemon.epoll_fd, EPOLL_CTL_DEL, conn->watch.fd, nullptr);
+  for (auto &entry : conn->requests)
+    kill(-entry.second->pid, SIGHUP);
+}
+
+/**
+ * @brief Writes as much queued output as the client takes without blocking,
+ * arms EPOLLOUT for the rest, and resumes paused pipes once it drains.
+ * Closes the connection when there is nothing left to do for it.
+ * @return false if the connection was closed
+ */
+static bool flush_connection(Daemon &daemon, Connection *conn) {
+  while (!conn->broken && conn->output_pos < conn->output.size()) {
+    ssize_t n = write(conn->watch.fd, conn->output.data() + conn->output_pos,
+                      conn->output.size() - conn->output_pos);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN)
+        mark_broken(daemon, conn);
+      break;
+    }
+    conn->output_pos += n;
+  }
+  if (conn->broken || conn->output_pos == conn->output.size()) {
+    conn->output.clear();
+    conn->output_pos = 0;
+  } else if (conn->output_pos > (1 << 16)) {
+    conn->output.erase(0, conn->output_pos);
+    conn->output_pos = 0;
+  }
+
+  if ((conn->broken || conn->read_closed) && conn->requests.empty() &&
+      conn->output.empty()) {
+    close_connection(daemon, conn);
+    return false;
+  }
+
+  uint32_t events = (conn->read_closed ? 0 : READABLE) |
+                    (conn->output.empty() ? 0 : WRITABLE);
+  if (!conn->broken && events != conn->events) {
+    conn->events = events;
+    watch_fd(daemon, &conn->watch, events, EPOLL_CTL_MOD);
+  }
+  set_paused(daemon, conn,
+             !conn->broken && conn->output.size() > CLIENT_OUTPUT_LIMIT);
+  return true;
+}
+
+// Sends the exit frame once the runner is gone and both pipes hit EOF.
+static void finish_request(Daemon &daemon, Connection *conn, Request *request) {
+  if (request->status == -1 || request->out.fd != -1 || request->err.fd != -1)
+    return;
+  if (!conn->broken) {
+    int32_t status = request->status;
+    append_frame(conn->output, FRAME_EXIT, request->id, &status,
+                 sizeof(status));
+  }
+  conn->requests.erase(request->id);
+  delete request;
+  flush_connection(daemon, conn);
+}
+
+static void start_request(Daemon &daemon, Connection *conn, uint32_t id,
+                          string &line) {
+  int out[2], err[2];
+  if (conn->requests.count(id) || pipe2(out, O_CLOEXEC) == -1) {
+    int32_t status = 126;
+    append_frame(conn->output, FRAME_EXIT, id, &status, sizeof(status));
+    return;
+  }
+  if (pipe2(err, O_CLOEXEC) == -1) {
+    close(out[0]);
+    close(out[1]);
+    int32_t status = 126;
+    append_frame(conn->output, FRAME_EXIT, id, &status, sizeof(status));
+    return;
+  }
+
+  pid_t pid = start_runner(daemon, line, out[1], err[1]);
+  close(out[1]);
+  close(err[1]);
+  Request *request = new Request;
+  request->id = id;
+  request->pid = pid;
+  request->status = pid > 0 ? -1 : 126;
+  request->out = {Watch::OUTPUT, conn, request, FRAME_STDOUT, out[0]};
+  request->err = {Watch::OUTPUT, conn, request, FRAME_STDERR, err[0]};
+  conn->requests[id] = request;
+  if (pid > 0)
+    daemon.runners[pid] = {conn, request};
+  watch_fd(daemon, &request->out, conn->paused ? 0 : READABLE, EPOLL_CTL_ADD);
+  watch_fd(daemon, &request->err, conn->paused ? 0 : READABLE, EPOLL_CTL_ADD);
+}
+
+static void read_client(Daemon &daemon, Connection *conn) {
+  ssize_t n;
+  FrameHeader header = {};
+  string payload;
+  while ((n = conn->reader.fill()) > 0) {
+    while (conn->reader.next(header, payload)) {
+      if (header.type == FRAME_RUN)
+        start_request(daemon, conn, header.id, payload);
+    }
+  }
+  if (n == 0) {
+    conn->read_closed = true;
+  } else if (errno == EPROTO) {
+    // An oversized frame fails its request; nothing after it can be framed,
+    // so the client is read no further but gets the answers it is owed.
+    int32_t status = 126;
+    append_frame(conn->output, FRAME_EXIT, header.id, &status, sizeof(status));
+    conn->read_closed = true;
+  } else if (errno != EAGAIN) {
+    mark_broken(daemon, conn);
+  }
+  flush_connection(daemon, conn);
+}
+
+static void read_output(Daemon &daemon, Watch *stream) {
+  Connection *conn = stream->conn;
+  char buffer[1 << 16];
+  ssize_t n = read(stream->fd, buffer, sizeof(buffer));
+  if (n == -1 && (errno == EINTR || errno == EAGAIN))
+    return;
+  if (n > 0) {
+    if (!conn->broken)
+      append_frame(conn->output, stream->frame, stream->request->id, buffer, n);
+    flush_connection(daemon, conn);
+    return;
+  }
+  epoll_ctl(daemon.epoll_fd, EPOLL_CTL_DEL, stream->fd, nullptr);
+  close(stream->fd);
+  stream->fd = -1;
+  finish_request(daemon, conn, stream->request);
+}
+
+static void reap_runners(Daemon &daemon) {
+  struct signalfd_siginfo info;
+  while (read(daemon.signals.fd, &info, sizeof(info)) > 0) {
+  }
+  int status;
+  pid_t pid;
+  while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+    auto it = daemon.runners.find(pid);
+    if (it == daemon.runners.end())
+      continue;
+    Connection *conn = it->second.first;
+    Request *request = it->second.second;
+    daemon.runners.erase(it);
+    request->status = WIFEXITED(status) ? WEXITSTATUS(status)
+                                        : 128 + WTERMSIG(status);
+    finish_request(daemon, conn, request);
+  }
+}
+
+static void accept_clients(Daemon &daemon) {
+  int fd;
+  while ((fd = accept4(daemon.listen.fd, nullptr, nullptr,
+                       SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+    Connection *conn = new Connection(fd);
+    conn->watch = {Watch::CLIENT, conn, nullptr, 0, fd};
+    conn->output_pos = 0;
+    conn->events = EPOLLIN;
+    conn->paused = false;
+    conn->read_closed = false;
+    conn->broken = false;
+    conn->closed = false;
+    watch_fd(daemon, &conn->watch, EPOLLIN, EPOLL_CTL_ADD);
+  }
+}
+
+/**
+ * @brief Runs tsh as a daemon on a Unix domain socket until it is killed.
+ *
+ * Clients send FRAME_RUN frames, each with a command line and an id of their
+ * choosing, and may have any number of them in flight. Each one runs in a
+ * forked runner (see start_runner()), so shell startup is paid once and a
+ * request starts with a fork() of an already warm process. Its stdout and
+ * stderr come back as FRAME_STDOUT/FRAME_STDERR chunks as they are produced,
+ * followed by FRAME_EXIT with its `$?`. Requests do not share state: a `cd`
+ * or `export` lasts for its own line only.
+ *
+ * Everything runs on one thread around epoll: accepting, reading requests,
+ * relaying output and reaping runners (SIGCHLD through a signalfd). No
+ * socket or pipe is ever read or written blocking, so a running pipeline or
+ * a slow client never holds up anybody else. A client that falls more than
+ * CLIENT_OUTPUT_LIMIT behind has its requests' pipes paused, which stalls
+ * only its own pipelines. A client that disconnects has its runners'
+ * process groups sent SIGHUP.
+ *
+ * @return 1 if the socket could not be set up
+ */
+int run_server(const char *socket_path) {
+  struct sockaddr_un addr;
+  if (!socket_address(socket_path, addr))
+    return 1;
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (listen_fd == -1) {
+    perror("tsh: socket");
+    return 1;
+  }
+  unlink(socket_path);
+  if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+      listen(listen_fd, 128) == -1) {
+    perror("tsh: bind/listen");
+    close(listen_fd);
+    return 1;
+  }
+
+  Daemon daemon;
+  signal(SIGPIPE, SIG_IGN);
+  sigset_t chld;
+  sigemptyset(&chld);
+  sigaddset(&chld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &chld, &daemon.old_mask);
+  daemon.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  daemon.listen = {Watch::LISTEN, nullptr, nullptr, 0, listen_fd};
+  daemon.signals = {Watch::SIGNALS, nullptr, nullptr, 0,
+                    signalfd(-1, &chld, SFD_NONBLOCK | SFD_CLOEXEC)};
+  watch_fd(daemon, &daemon.listen, EPOLLIN, EPOLL_CTL_ADD);
+  watch_fd(daemon, &daemon.signals, EPOLLIN, EPOLL_CTL_ADD);
+
+  struct epoll_event events[64];
+  while (true) {
+    int count = epoll_wait(daemon.epoll_fd, events, 64, -1);
+    if (count == -1 && errno != EINTR) {
+      perror("tsh: epoll_wait");
+      return 1;
+    }
+    for (int i = 0; i < count; i++) {
+      Watch *watch = (Watch *)events[i].data.ptr;
+      switch (watch->kind) {
+        case Watch::LISTEN:
+          accept_clients(daemon);
+          break;
+        case Watch::SIGNALS:
+          reap_runners(daemon);
+          break;
+        case Watch::CLIENT:
+          if (watch->conn->closed) {
+            break;
+          } else if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+            mark_broken(daemon, watch->conn);
+            flush_connection(daemon, watch->conn);
+          } else if (events[i].events & EPOLLIN) {
+            read_client(daemon, watch->conn);
+          } else {
+            flush_connection(daemon, watch->conn);
+          }
+          break;
+        case Watch::OUTPUT:
+          read_output(daemon, watch);
+          break;
+      }
+    }
+    for (Connection *conn : daemon.closed)
+      delete conn;
+    daemon.closed.clear();
+  }
+}
@@ -0,0 +1,125 @@
+#include <fcntl.h>
+#include <stats.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+using namespace std;
+
+double seconds_between(const struct timespec &start,
+                       const struct timespec &end) {
+  return end.tv_sec - start.tv_sec + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static double tv_seconds(const struct timeval &tv) {
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void timeval_sub(struct timeval &after, const struct timeval &before) {
+  after.tv_sec -= before.tv_sec;
+  after.tv_usec -= before.tv_usec;
+  if (after.tv_usec < 0) {
+    after.tv_sec--;
+    after.tv_usec += 1000000;
+  }
+}
+
+/**
+ * @brief Turns `after` into the usage accumulated since `before`. Max RSS is
+ * a high-water mark and is left as it is.
+ */
+void usage_delta(const struct rusage &before, struct rusage &after) {
+  timeval_sub(after.ru_utime, before.ru_utime);
+  timeval_sub(after.ru_stime, before.ru_stime);
+  after.ru_nvcsw -= before.ru_nvcsw;
+  after.ru_nivcsw -= before.ru_nivcsw;
+}
+
+/**
+ * @brief Prints one row per command of a pipeline and the pipeline's totals,
+ * as the `time` prefix reports them. Real time spans from the first launch
+ * to the last command being reaped.
+ */
+void print_stats(FILE *out, const vector<ProcessStats> &stats) {
+  if (stats.empty())
+    return;
+  fprintf(out, "%9s %9s %9s %10s %6s %6s %6s  %s\n", "wall", "user", "sys",
+          "maxrss", "vcsw", "ivcsw", "status", "command");
+
+  struct timespec first = stats.front().start, last = stats.front().end;
+  double user = 0, sys = 0;
+  for (const ProcessStats &s : stats) {
+    if (seconds_between(s.start, first) > 0)
+      first = s.start;
+    if (seconds_between(last, s.end) > 0)
+      last = s.end;
+    user += tv_seconds(s.usage.ru_utime);
+    sys += tv_seconds(s.usage.ru_stime);
+    fprintf(out, "%8.3fs %8.3fs %8.3fs %8ldKB %6ld %6ld %6d  %s%s\n",
+            seconds_between(s.start, s.end), tv_seconds(s.usage.ru_utime),
+            tv_seconds(s.usage.ru_stime), s.usage.ru_maxrss, s.usage.ru_nvcsw,
+            s.usage.ru_nivcsw, s.status, s.command.c_str(),
+            s.builtin ? " (builtin)" : "");
+  }
+  fprintf(out, "real %.3fs  user %.3fs  sys %.3fs\n",
+          seconds_between(first, last), user, sys);
+  fflush(out);
+}
+
+static void json_string(string &line, const string &text) {
+  line += '"';
+  for (char c : text) {
+    if (c == '"' || c == '\\') {
+      line += '\\';
+      line += c;
+    } else if ((unsigned char)c < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      line += escaped;
+    } else {
+      line += c;
+    }
+  }
+  line += '"';
+}
+
+/**
+ * @brief Appends one JSON line for a finished command to the file named by
+ * TSH_STATS_LOG, if it is set. The file is reopened only when the variable
+ * changes, and each line goes out in a single O_APPEND write so concurrent
+ * shells can share a log.
+ */
+void log_stats(const ProcessStats &stats, int job_id) {
+  static string log_path;
+  static int log_fd = -1;
+
+  const char *path = getenv("TSH_STATS_LOG");
+  if (path == nullptr || *path == '\0')
+    return;
+  if (log_fd == -1 || log_path != path) {
+    if (log_fd != -1)
+      close(log_fd);
+    log_path = path;
+    log_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+    if (log_fd == -1) {
+      perror(path);
+      return;
+    }
+  }
+
+  char numbers[512];
+  snprintf(numbers, sizeof(numbers),
+           "\"pid\":%d,\"job\":%d,\"builtin\":%s,\"status\":%d,"
+           "\"wall\":%.6f,\"user\":%.6f,\"sys\":%.6f,\"maxrss_kb\":%ld,"
+           "\"nvcsw\":%ld,\"nivcsw\":%ld,\"command\":",
+           stats.pid, job_id, stats.builtin ? "true" : "false", stats.status,
+           seconds_between(stats.start, stats.end),
+           tv_seconds(stats.usage.ru_utime), tv_seconds(stats.usage.ru_stime),
+           stats.usage.ru_maxrss, stats.usage.ru_nvcsw, stats.usage.ru_nivcsw);
+  string line = "{";
+  line += numbers;
+  json_string(line, stats.command);
+  line += "}\n";
+  if (write(log_fd, line.data(), line.size()) == -1)
+    perror(path);
+}
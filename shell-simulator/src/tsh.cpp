@@ -1,3 +1,4 @@
+#include <poll.h>
 #include <tsh.h>
 #include <string>
 
@@ -14,13 +15,37 @@ using namespace std;
  * when a command needs more input (e.g. a multi-line command). PS3 is not very
  * commonly used
  */
-void display_prompt() { cout << "$ " << flush; }
+void display_prompt() {
+  if (interactive())
+    cout << "$ " << flush;
+}
+
+/**
+ * @brief Whether the shell is talking to a person. main() clears it when
+ * stdin is not a terminal so scripts piped into the shell are not
+ * interleaved with prompts.
+ */
+bool &interactive() {
+  static bool is_interactive = true;
+  return is_interactive;
+}
+
+/**
+ * @brief The arena backing the Process objects and token arrays of the line
+ * currently being run. parse_input() allocates from it and cleanup() resets it.
+ */
+Arena &line_arena() {
+  static Arena arena(64 * 1024);
+  return arena;
+}
 
 /**
  * @brief Cleans up allocated resources to prevent memory leaks.
  *
- * This function deletes all elements in the provided list of Process objects,
- * clears the list, and frees the memory allocated for the input line.
+ * This function destroys all elements in the provided list of Process objects,
+ * clears the list, releases the line arena they live in in one go, drops the
+ * directory listings globbing cached for the line, and frees the memory
+ * allocated for the input line.
  *
  * @param process_list A pointer to a list of Process pointers to be cleaned up.
  * @param input_line A pointer to the dynamically allocated memory for user
@@ -28,13 +53,41 @@ void display_prompt() { cout << "$ " << flush; }
  */
 void cleanup(list<Process *> &process_list, char *input_line) {
   for (Process *p : process_list) {
-    delete p;
+    p->~Process();
   }
   process_list.clear();
+  line_arena().reset();
+  glob_cache().forget();
   free(input_line);
   input_line = nullptr;
 }
 
+/**
+ * @brief Reads the rest of a for/while/until/if typed at the prompt, with a
+ * "> " prompt for every further line, and runs it. Takes `first_line`.
+ *
+ * @param depth how many blocks the first line left open
+ * @return true if quit or exit ran
+ */
+static bool run_compound(char *first_line, int depth) {
+  string block = first_line;
+  free(first_line);
+  while (depth > 0) {
+    if (interactive())
+      cout << "> " << flush;
+    char *line = read_input();
+    if (line == nullptr)
+      break;  // run_block() reports the missing done/fi
+    sanitize(line);
+    bool compound = false;
+    depth += block_depth(line, line + strlen(line), compound);
+    block += '\n';
+    block += line;
+    free(line);
+  }
+  return run_block(&block[0]);
+}
+
 /**
  * @brief Main loop for the shell, facilitating user interaction and command
  * execution.
@@ -75,34 +128,59 @@ void run() {
   list<Process *> process_list;
   char *input_line;
   bool is_quit = false;
+  if (interactive() && isatty(STDIN_FILENO))
+    job_table().enable_job_control();
   while(!is_quit) {
+    if (interactive())
+      job_table().notify(stdout);
     display_prompt();
     input_line = read_input();
     if (input_line == nullptr)
       break;
     sanitize(input_line); 
+    bool compound = false;
+    int depth = block_depth(input_line, input_line + strlen(input_line),
+                            compound);
+    if (compound) {
+      is_quit = run_compound(input_line, depth);
+      continue;
+    }
     parse_input(input_line, process_list);
     is_quit = run_commands(process_list);
+    cleanup(process_list, input_line);
+  }
+}
+
 
-    // if (*input_line != '\0') 
-    //   cout << endl;
-    process_list.clear();
+/**
+ * @brief Sleeps until stdin is readable while some job has a deadline, so a
+ * background job with TSH_TIMEOUT is stopped on time even at the prompt.
+ * Input stdio has already buffered (glibc's read pointers) needs no wait.
+ */
+static void wait_for_input() {
+  JobTable &jobs = job_table();
+  struct timespec left;
+  while (stdin->_IO_read_ptr == stdin->_IO_read_end &&
+         jobs.time_left(left) != nullptr) {
+    struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+    if (ppoll(&pfd, 1, &left, nullptr) > 0)
+      return;
+    jobs.update();  // a deadline passed, or SIGCHLD interrupted the wait
   }
 }
 
 /**
- * @brief Reads input from the standard input (stdin) in chunks and dynamically
- *        allocates memory to store the entire input.
+ * @brief Reads one line from the standard input (stdin), however long, into
+ * dynamically allocated memory.
  *
- * This function reads input from the standard input or file in chunks of size
- * MAX_LINE. It dynamically allocates memory to store the entire input, resizing
- * the memory as needed. The input is stored as a null-terminated string. The
- * function continues reading until a newline character is encountered or an
- * error occurs.
+ * getline() grows its buffer geometrically, so a long line costs a handful of
+ * reallocations instead of one per 81-byte fgets() chunk. The input is stored
+ * as a null-terminated string including its newline, if any. While jobs have
+ * deadlines, wait_for_input() enforces them until input arrives.
  *
  * @return A pointer to the dynamically allocated memory containing the input
  * string. The caller is responsible for freeing this memory when it is no
- * longer needed. If an error occurs or EOF is reached during input, the
+ * longer needed. If an error occurs or EOF is reached before any input, the
  * function returns NULL.
  *
  * @warning Ensure that the memory allocated by this function is freed using
@@ -110,21 +188,105 @@ void run() {
  */
 char *read_input() {
   char *input = NULL;
-  char tempbuf[MAX_LINE];
-  size_t inputlen = 0, templen = 0;
+  size_t capacity = 0;
+  wait_for_input();
+  if (getline(&input, &capacity, stdin) == -1) {
+    free(input);
+    return NULL;
+  }
+  return input;
+}
+
+/**
+ * @brief Runs every line of `text` (`len` bytes, not necessarily
+ * null-terminated) as if it had been typed, stopping at quit or exit.
+ *
+ * Lines are split in place: each newline is overwritten with '\0' and the line
+ * is handed to parse_input() where it lies, so nothing is copied or allocated
+ * per line. Only a final line without a newline is copied, to terminate it.
+ * Lines starting with '#' (including a #! line) are comments. A line using
+ * for/while/until/if is run with the lines up to its done/fi by run_block().
+ *
+ * @return true if the text ended with quit or exit
+ */
+bool run_lines(char *text, size_t len) {
+  list<Process *> process_list;
+  char *end = text + len;
+  string last_line;
+  bool is_quit = false;
+
+  for (char *line = text; line < end && !is_quit;) {
+    char *newline = (char *)memchr(line, '\n', end - line);
+    char *line_end = newline != nullptr ? newline : end;
 
-  do {
-    char *a = fgets(tempbuf, MAX_LINE, stdin);
-    if (a == nullptr) {
-      return input;
+    // A for/while/until/if runs as one block, however many lines it spans.
+    bool compound = false;
+    int depth = block_depth(line, line_end, compound);
+    while (compound && depth > 0 && line_end < end) {
+      char *start = line_end + 1;
+      newline = (char *)memchr(start, '\n', end - start);
+      line_end = newline != nullptr ? newline : end;
+      depth += block_depth(start, line_end, compound);
     }
-    templen = strlen(tempbuf);
-    input = (char *)realloc(input, inputlen + templen + 1);
-    strcpy(input + inputlen, tempbuf);
-    inputlen += templen;
-  } while (templen == MAX_LINE - 1 && tempbuf[MAX_LINE - 2] != '\n');
 
-  return input;
+    char *next = end;
+    if (line_end < end) {
+      *line_end = '\0';
+      next = line_end + 1;
+    } else {
+      last_line.assign(line, end - line);
+      line = &last_line[0];
+    }
+
+    char *first = line + strspn(line, " \t");
+    if (compound) {
+      is_quit = run_block(line);
+      job_table().notify(nullptr);
+    } else if (*first != '#') {
+      parse_input(line, process_list);
+      is_quit = run_commands(process_list);
+      cleanup(process_list, nullptr);
+      job_table().notify(nullptr);
+    }
+    line = next;
+  }
+  return is_quit;
+}
+
+/**
+ * @brief Runs a script file without reading it through stdio: the file is
+ * mapped copy-on-write and split in place by run_lines(), so only the pages
+ * holding newlines are ever copied.
+ *
+ * @return the exit status of the last pipeline, or 127 if the script cannot
+ * be opened
+ */
+int run_script(const char *filename) {
+  int fd = open(filename, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd == -1 || fstat(fd, &st) == -1) {
+    fprintf(stderr, "tsh: %s: %s\n", filename, strerror(errno));
+    if (fd != -1)
+      close(fd);
+    return 127;
+  }
+  if (st.st_size == 0) {
+    close(fd);
+    return 0;
+  }
+
+  size_t len = st.st_size;
+  char *text = (char *)mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                            fd, 0);
+  close(fd);
+  if (text == MAP_FAILED) {
+    fprintf(stderr, "tsh: %s: %s\n", filename, strerror(errno));
+    return 127;
+  }
+  madvise(text, len, MADV_SEQUENTIAL);
+  run_lines(text, len);
+  munmap(text, len);
+  return last_status();
 }
 
 /**
@@ -144,84 +306,122 @@ void sanitize(char *cmd) {
  * Parses the given command string and populates a list of Process objects.
  *
  * This function takes a command string and a reference to a list of Process
- * pointers. It tokenizes the command based on the delimiters "|; " and creates
- * a new Process object for each token. The created Process objects are added to
- * the provided process_list. Additionally, it sets pipe flags for each Process
- * based on the presence of pipe delimiters '|' in the original command string.
+ * pointers. It tokenizes the command based on the delimiters "|;&&&<> " and creates
+ * a new Process object for each command. The created Process objects are
+ * added to the provided process_list. Additionally, it sets pipe flags for
+ * each Process based on the presence of pipe delimiters '|' in the original
+ * command string, and marks the last Process of a pipeline followed by '&' to
+ * run in the background, by '&&&' to run in parallel with the next one, or
+ * by '&&' / '||' to make the next pipeline depend on its status.
+ * Redirections (`<`, `>`, `>>`, `n>`, `n>>`, `n>&m`) are recorded on their
+ * Process in order; a command made only of redirections is dropped.
  *
- * @param cmd The command string to be parsed.
+ * The command string is split in place: delimiters are overwritten with '\0'
+ * and every token points into `cmd`, so nothing is copied. The Process objects
+ * and their token arrays come from `arena` (line_arena() unless the caller
+ * keeps them longer, as parsed scripts do), so `cmd` must outlive them and
+ * cleanup() releases them all at once.
+ *
+ * @param cmd The command string to be parsed. It is modified.
  * @param process_list A reference to a list of Process pointers where the
  * created Process objects will be stored.
- *
- * Hints for students:
- * - The 'delimiters' we need to handle are '|', ';', and '[space]'
- * - 'pipe_in_val' is a flag indicating whether the current Process should take
- *      input from a previous Process (1 if true, 0 if false).
- * - 'currProcess' is a pointer to the current Process being created and added
- *      to the list.
- * - When a delim is a space it calls currProcess->add_token()
- * - When the delimiter is a ";" or "|", a new Process object is created with
- *       relevant information, and the pipe flags are set based on the presence
- *       of '|' in the original command.
- * - The created Process objects are added to the process_list.
+ * @param arena where the Process objects and their token arrays are allocated
  */
-void parse_input(char *cmd, list<Process *> &process_list) {
+void parse_input(char *cmd, list<Process *> &process_list, Arena &arena) {
   if (cmd == nullptr)
     return;
-  int pipe_in_val = 0;
+  bool pipe_in_val = false;
   Process *currProcess = nullptr;
-  char *s = (char*) malloc(sizeof(char) * 256000);
-  int len = 0;
-  s[0] = '\0';
-
-  for(int i = 0; cmd[i] != '\0'; ++i) {
-    if (cmd[i] == ' ') {
-      if (s[0] != '\0') {
-        if (currProcess == nullptr) {
-          currProcess = new Process(pipe_in_val, false);
-          pipe_in_val = 0; 
-        }
-        sanitize(s);
-        currProcess->add_token(strdup(s));
+  char *tok = nullptr;  // start of the token being scanned, if any
+  bool want_target = false;  // the next word is a redirection target
+
+  for (char *c = cmd;; ++c) {
+    char delim = *c;
+    bool is_space = delim == ' ' || delim == '\t' || delim == '\n';
+    bool is_end =
+        delim == '\0' || delim == '|' || delim == ';' || delim == '&';
+    bool is_redirect = delim == '<' || delim == '>';
+    if (!is_space && !is_end && !is_redirect) {
+      if (tok == nullptr)
+        tok = c;
+      continue;
+    }
+
+    // A number written right against the operator names the fd, as in 2>.
+    int redirect_fd = -1;
+    if (is_redirect && tok != nullptr && !want_target &&
+        strspn(tok, "0123456789") == (size_t)(c - tok)) {
+      redirect_fd = atoi(tok);
+      tok = nullptr;
+    }
+
+    bool parallel = delim == '&' && c[1] == '&' && c[2] == '&';
+    bool and_then = !parallel && delim == '&' && c[1] == '&';
+    bool or_else = delim == '|' && c[1] == '|';
+    *c = '\0';
+    if (tok != nullptr || is_redirect) {
+      if (currProcess == nullptr) {
+        currProcess = arena.make<Process>(pipe_in_val, false, &arena);
+        pipe_in_val = false;
       }
-      len = 0;
-      s[0] = '\0';
-    }
-    else if (cmd[i] == '|' || cmd[i] == ';') {
-      if (s[0] != '\0') {
-        if (currProcess == nullptr) {
-          currProcess = new Process(pipe_in_val, false);
-          pipe_in_val = 0; 
-        }
-        sanitize(s);
-        currProcess->add_token(strdup(s));
+    }
+    if (tok != nullptr) {
+      if (want_target) {
+        currProcess->redirects[currProcess->redirect_count - 1].target = tok;
+        want_target = false;
+      } else {
+        currProcess->add_token(tok);
       }
-      len = 0;
-      s[0] = '\0';
-      if (cmd[i] == '|') {
-        pipe_in_val = 1; 
-        currProcess->pipe_out = 1; 
-      } 
-      currProcess->add_token(nullptr);
-      process_list.push_back(currProcess);
-      // cout << endl;
-      currProcess = nullptr;
+      tok = nullptr;
     }
-    else {
-      s[len++] = cmd[i]; 
-      s[len] = '\0';
+
+    if (is_redirect) {
+      Redirect r = {delim == '<' ? 0 : 1, Redirect::WRITE, nullptr, -1};
+      if (redirect_fd != -1)
+        r.fd = redirect_fd;
+      if (delim == '<') {
+        r.kind = Redirect::READ;
+      } else if (c[1] == '>') {
+        r.kind = Redirect::APPEND;
+        c++;
+      }
+      if (r.kind == Redirect::WRITE && c[1] == '&' && isdigit(c[2])) {
+        char *end;
+        r.kind = Redirect::DUP;
+        r.src_fd = strtol(c + 2, &end, 10);
+        c = end - 1;
+      } else {
+        want_target = true;
+      }
+      currProcess->add_redirect(r);
+      continue;
     }
-  }
 
-  if (s[0] != '\0') {
-    if (currProcess == nullptr)
-      currProcess = new Process(pipe_in_val, false);
-    sanitize(s);
-    currProcess->add_token(strdup(s));
-  }
-  if (currProcess != nullptr) {
-    currProcess->add_token(nullptr);
-    process_list.push_back(currProcess);
+    if (is_end && currProcess != nullptr) {
+      if (and_then) {
+        currProcess->and_then = true;
+      } else if (or_else) {
+        currProcess->or_else = true;
+      } else if (delim == '|') {
+        pipe_in_val = true;
+        currProcess->pipe_out = true;
+      } else if (parallel) {
+        currProcess->parallel = true;
+      } else if (delim == '&') {
+        currProcess->background = true;
+      }
+      currProcess->add_token(nullptr);
+      if (currProcess->cmdTokens[0] != nullptr)  // not just redirections
+        process_list.push_back(currProcess);
+      currProcess = nullptr;
+      want_target = false;
+    }
+    if (parallel)
+      c += 2;
+    else if (and_then || or_else)
+      c++;
+    if (delim == '\0')
+      break;
   }
 }
 
@@ -242,6 +442,410 @@ bool isQuit(Process *p) {
   return strcmp(p->cmdTokens[0], "quit") == 0;  
 }
 
+/**
+ * @brief Appends a command's words to the text `jobs` shows for its job.
+ */
+static void describe(Job *job, Process *p) {
+  if (!job->command.empty())
+    job->command += " | ";
+  for (int i = 0; p->cmdTokens[i] != nullptr; i++) {
+    if (i > 0)
+      job->command += ' ';
+    job->command += p->cmdTokens[i];
+  }
+  if (p->background && !p->pipe_out)
+    job->command += " &";
+}
+
+/**
+ * @brief Appends the expansion of `word` to `out`: `$?` is the last status,
+ * `$$` the shell's pid, and `$NAME` / `${NAME}` a variable's value (empty if
+ * unset). A '$' starting none of these is kept.
+ */
+void expand_word(const char *word, string &out) {
+  for (const char *c = word; *c != '\0'; c++) {
+    if (*c != '$') {
+      out += *c;
+      continue;
+    }
+    char number[12];
+    if (c[1] == '?' || c[1] == '$') {
+      snprintf(number, sizeof(number), "%d",
+               c[1] == '?' ? last_status() : (int)getpid());
+      out += number;
+      c++;
+      continue;
+    }
+    bool braced = c[1] == '{';
+    const char *name = c + 1 + braced;
+    const char *end = name;
+    if (isalpha(*end) || *end == '_') {
+      while (isalnum(*end) || *end == '_')
+        end++;
+    }
+    if (end == name || (braced && *end != '}')) {
+      out += *c;
+      continue;
+    }
+    const char *value = get_variable(name, end - name);
+    if (value != nullptr)
+      out += value;
+    c = end - !braced;
+  }
+}
+
+/**
+ * @brief Expands `word` and appends the fields it yields to `fields`: the
+ * expansion is split at blanks, as an unquoted one is in sh, so a word that
+ * expands to nothing yields none. A field that is a pattern is replaced by
+ * the paths it matches (glob_cache()).
+ */
+void expand_fields(const char *word, vector<string> &fields) {
+  if (strchr(word, '$') == nullptr) {
+    if (has_glob(word)) {
+      glob_cache().expand(word, fields);
+    } else {
+      fields.push_back(word);
+    }
+    return;
+  }
+  string expanded;
+  expand_word(word, expanded);
+  size_t start = expanded.find_first_not_of(" \t\n");
+  while (start != string::npos) {
+    size_t end = expanded.find_first_of(" \t\n", start);
+    string field = expanded.substr(start, end - start);
+    if (has_glob(field.c_str())) {
+      glob_cache().expand(field.c_str(), fields);
+    } else {
+      fields.push_back(field);
+    }
+    start = expanded.find_first_not_of(" \t\n", end);
+  }
+}
+
+static char *arena_copy(const string &text) {
+  char *copy = (char *)line_arena().alloc(text.size() + 1, 1);
+  memcpy(copy, text.c_str(), text.size() + 1);
+  return copy;
+}
+
+/**
+ * @brief Expands the variables and patterns in p's words, and the variables
+ * in its redirection targets, just before it runs. Words are split into
+ * fields (expand_fields()) except assignments; a command left with no words
+ * becomes `true`. The new text lives in the line arena like the rest of the
+ * line, and a command with nothing to expand is left alone.
+ */
+static void expand_words(Process *p) {
+  bool special = false;
+  for (int i = 0; p->cmdTokens[i] != nullptr && !special; i++)
+    special = strchr(p->cmdTokens[i], '$') != nullptr ||
+              has_glob(p->cmdTokens[i]);
+  for (int i = 0; i < p->redirect_count; i++) {
+    char *&target = p->redirects[i].target;
+    if (target != nullptr && strchr(target, '$') != nullptr) {
+      string expanded;
+      expand_word(target, expanded);
+      target = arena_copy(expanded);
+    }
+  }
+  if (!special)
+    return;
+
+  char **words = p->cmdTokens;
+  int count = p->tok_index;
+  p->cmdTokens = nullptr;
+  p->tok_index = 0;
+  p->tok_capacity = 0;
+  vector<string> fields;
+  for (int i = 0; i < count && words[i] != nullptr; i++) {
+    if (strchr(words[i], '$') == nullptr && !has_glob(words[i])) {
+      p->add_token(words[i]);
+    } else if (is_assignment(words[i])) {
+      string expanded;
+      expand_word(words[i], expanded);
+      p->add_token(arena_copy(expanded));
+    } else {
+      fields.clear();
+      expand_fields(words[i], fields);
+      for (const string &field : fields)
+        p->add_token(arena_copy(field));
+    }
+  }
+  if (p->tok_index == 0)
+    p->add_token((char *)"true");
+  p->add_token(nullptr);
+}
+
+/**
+ * @brief Opens the targets of p's redirections in the shell and turns every
+ * redirection into a (source fd, target fd) pair to dup2, in the order they
+ * were written. Opened fds are close-on-exec and listed in `opened` for the
+ * caller to close.
+ *
+ * @return false (after reporting why) if a target cannot be opened or a
+ * source fd is not open
+ */
+static bool open_redirects(Process *p, vector<pair<int, int>> &moves,
+                           vector<int> &opened) {
+  for (int i = 0; i < p->redirect_count; i++) {
+    const Redirect &r = p->redirects[i];
+    if (r.kind == Redirect::DUP) {
+      bool earlier = false;
+      for (const pair<int, int> &move : moves)
+        earlier = earlier || move.second == r.src_fd;
+      if (!earlier && fcntl(r.src_fd, F_GETFD) == -1) {
+        fprintf(stderr, "tsh: %d: %s\n", r.src_fd, strerror(errno));
+        return false;
+      }
+      moves.push_back({r.src_fd, r.fd});
+      continue;
+    }
+    if (r.target == nullptr) {
+      fprintf(stderr, "tsh: syntax error: missing redirection target\n");
+      return false;
+    }
+
+    int flags = O_CLOEXEC;
+    if (r.kind == Redirect::READ)
+      flags |= O_RDONLY;
+    else if (r.kind == Redirect::WRITE)
+      flags |= O_WRONLY | O_CREAT | O_TRUNC;
+    else
+      flags |= O_WRONLY | O_CREAT | O_APPEND;
+    int fd = open(r.target, flags, 0666);
+    if (fd == -1) {
+      fprintf(stderr, "tsh: %s: %s\n", r.target, strerror(errno));
+      return false;
+    }
+    opened.push_back(fd);
+    moves.push_back({fd, r.fd});
+  }
+  return true;
+}
+
+static void close_fds(vector<int> &fds) {
+  for (int fd : fds)
+    close(fd);
+  fds.clear();
+}
+
+/**
+ * @brief Launches one pipeline (its stages connected by pipes) as a new Job,
+ * without waiting for it.
+ *
+ * Each stage's pipe wiring is expressed as dup2/close fd actions that the
+ * spawn backend (fork or posix_spawn, see launch()) applies before executing
+ * the path resolved through path_cache(). Builtins run in a forked child so
+ * they write into the pipe. Stages that are not on PATH are reported by the
+ * shell and not started; a child whose execve fails exits with status 126.
+ * Redirections are opened by the shell (so errors name the file) and dup2'd
+ * in the child after the pipes, so they take precedence over them.
+ *
+ * @param stages the pipeline, first stage first
+ * @param out_fd if not -1, the last stage's stdout
+ * @param grouped whether the pipeline gets its own process group (and the
+ * terminal, in the foreground) under job control
+ * @return the Job, registered in job_table(); it has no pids if nothing
+ * could be started
+ */
+Job *launch_pipeline(const vector<Process *> &stages, int out_fd,
+                     bool grouped) {
+  JobTable &jobs = job_table();
+  Job *job = jobs.create(stages.back()->background, grouped);
+  Process *prev = nullptr;
+  vector<pair<int, int>> moves;
+  vector<int> opened;
+
+  for (Process *cur : stages) {
+    describe(job, cur);
+    const Builtin *builtin = find_builtin(cur->cmdTokens);
+
+    // Resolve the command in the parent so the hash table remembers it and
+    // the child can execve() the absolute path without searching PATH.
+    string path;
+    bool found =
+        builtin != nullptr || path_cache().lookup(cur->cmdTokens[0], path);
+
+    if (cur->pipe_out) {
+      pipe2(cur->pipe_fd, O_CLOEXEC);
+      if (builtin != nullptr && builtin->pipe_size != 0) {
+        fcntl(cur->pipe_fd[1], F_SETPIPE_SZ, builtin->pipe_size);
+      }
+    }
+
+    LaunchSpec spec;
+    spec.path = path.c_str();
+    spec.argv = cur->cmdTokens;
+    if (builtin != nullptr) {
+      spec.builtin = builtin->run;
+    }
+    if (job->grouped) {  // one process group per pipeline
+      spec.pgid = job->pgid;
+      if (job->pgid == 0 && !job->background) {
+        spec.tcsetpgrp(STDIN_FILENO);
+      }
+    }
+    if (prev != nullptr) {  //receive input from previous
+      spec.dup2(prev->pipe_fd[0], STDIN_FILENO);
+      spec.close(prev->pipe_fd[0]);
+    }
+    if (cur->pipe_out) {
+      spec.dup2(cur->pipe_fd[1], STDOUT_FILENO);
+      spec.close(cur->pipe_fd[0]);
+      spec.close(cur->pipe_fd[1]);
+    } else if (out_fd != -1) {
+      spec.dup2(out_fd, STDOUT_FILENO);
+    }
+    moves.clear();
+    bool redirected = open_redirects(cur, moves, opened);
+    for (const pair<int, int> &move : moves) {
+      spec.dup2(move.first, move.second);
+    }
+
+    pid_t pid = -1;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (!redirected) {
+      jobs.add_failure(job, cur->cmdTokens[0], 1);
+    } else if (!found) {
+      fprintf(stderr, "tsh: %s: command not found\n", cur->cmdTokens[0]);
+      jobs.add_failure(job, cur->cmdTokens[0], 127);
+    } else if ((pid = launch(spec)) < 0) {
+      jobs.add_failure(job, cur->cmdTokens[0], 126);
+    } else {
+      jobs.add_process(job, pid, cur->cmdTokens[0], start);
+    }
+    close_fds(opened);
+
+    // parent: the previous pipe now belongs to the children, and only the
+    // read end of the current one is still needed for the next stage.
+    if (prev != nullptr) {
+      close(prev->pipe_fd[0]);
+    }
+    if (cur->pipe_out) {
+      close(cur->pipe_fd[1]);
+    }
+    prev = cur;
+  }
+  if (prev->pipe_out) {  // pipeline ended in '|'
+    close(prev->pipe_fd[0]);
+  }
+  return job;
+}
+
+/**
+ * @brief Runs a builtin in the shell itself with p's redirections applied to
+ * the shell's own fds, which are put back afterwards. Its cost is measured
+ * with getrusage() on the shell, logged like any command's, and printed
+ * when `timed`.
+ */
+static void run_redirected(const Builtin *builtin, Process *p, bool timed) {
+  vector<pair<int, int>> moves;
+  vector<int> opened;
+  if (!open_redirects(p, moves, opened)) {
+    close_fds(opened);
+    last_status() = 1;
+    return;
+  }
+
+  fflush(stdout);
+  fflush(stderr);
+  vector<pair<int, int>> saved;  // (fd, copy of what it was, or -1)
+  for (const pair<int, int> &move : moves) {
+    bool seen = false;
+    for (const pair<int, int> &s : saved)
+      seen = seen || s.first == move.second;
+    if (!seen)
+      saved.push_back({move.second, fcntl(move.second, F_DUPFD_CLOEXEC, 10)});
+    dup2(move.first, move.second);
+  }
+  for (int fd : opened) {
+    bool target = false;  // open() may have returned the target fd itself
+    for (const pair<int, int> &s : saved)
+      target = target || s.first == fd;
+    if (!target)
+      close(fd);
+  }
+
+  ProcessStats stats;
+  stats.pid = getpid();
+  stats.command = p->cmdTokens[0];
+  stats.builtin = true;
+  struct rusage before;
+  getrusage(RUSAGE_SELF, &before);
+  clock_gettime(CLOCK_MONOTONIC, &stats.start);
+
+  last_status() = builtin->run(p->cmdTokens);
+
+  fflush(stdout);
+  fflush(stderr);
+  clock_gettime(CLOCK_MONOTONIC, &stats.end);
+  getrusage(RUSAGE_SELF, &stats.usage);
+  usage_delta(before, stats.usage);
+  stats.status = last_status();
+  stats.done = true;
+
+  for (auto it = saved.rbegin(); it != saved.rend(); ++it) {
+    if (it->second == -1) {
+      close(it->first);
+    } else {
+      dup2(it->second, it->first);
+      close(it->second);
+    }
+  }
+  log_stats(stats, 0);
+  if (timed)
+    print_stats(stderr, {stats});
+}
+
+/**
+ * @brief Runs one pipeline to completion, or starts it in the background if
+ * it ends in '&'. A builtin on its own runs in the shell (unless it `forks`),
+ * so cd/export/exit change the shell's own state and nothing is forked; so do NAME=value
+ * assignments, which set shell variables. A leading `time`
+ * prints the wall/user/sys time, max RSS and context switches of every
+ * command once the pipeline is done.
+ *
+ * @return true if the pipeline was an exit builtin
+ */
+static bool run_pipeline(const vector<Process *> &stages) {
+  Process *first = stages.front();
+
+  // `time pipeline` reports what every command of the pipeline cost.
+  bool timed = strcmp(first->cmdTokens[0], "time") == 0 &&
+               first->cmdTokens[1] != nullptr;
+  if (timed) {
+    memmove(first->cmdTokens, first->cmdTokens + 1,
+            sizeof(char *) * --first->tok_index);
+  }
+
+  // NAME=value ... on its own sets shell variables.
+  bool assignments = stages.size() == 1 && !first->background;
+  for (int i = 0; assignments && first->cmdTokens[i] != nullptr; i++)
+    assignments = is_assignment(first->cmdTokens[i]);
+  if (assignments) {
+    for (int i = 0; first->cmdTokens[i] != nullptr; i++) {
+      const char *eq = strchr(first->cmdTokens[i], '=');
+      set_variable(first->cmdTokens[i], eq - first->cmdTokens[i], eq + 1);
+    }
+    last_status() = 0;
+    return false;
+  }
+
+  const Builtin *builtin = find_builtin(first->cmdTokens);
+  if (builtin != nullptr && !builtin->forks && stages.size() == 1 &&
+      !first->pipe_out && !first->background) {
+    run_redirected(builtin, first, timed);
+    return exit_requested();
+  }
+  Job *job = launch_pipeline(stages);
+  job->timed = timed;
+  job_table().finish(job);
+  return false;
+}
+
 /**
  * @brief Execute a list of commands using processes and pipes.
  *
@@ -261,20 +865,25 @@ bool isQuit(Process *p) {
  * The function iterates through the provided list of processes and performs the
  * following steps:
  * 1. Check if a quit command is encountered. If yes, terminate execution.
- * 2. Create pipes and fork a child process for each command.
- * 3. In the parent process, close unused pipes, wait for child processes to
- * finish if necessary, and continue to the next command.
- * 4. In the child process, set up pipes for input and output, execute the
- * command using execvp, and handle errors if the command is invalid.
- * 5. Cleanup final process and wait for all child processes to finish.
+ * 2. Group the processes into pipelines (stages connected by '|').
+ * 3. Run each pipeline with run_pipeline(): a lone builtin (find_builtin())
+ * runs in the shell itself and nothing is forked, unless it may block (cat); anything else is started by
+ * launch_pipeline() and recorded as a Job (see JobTable).
+ * 4. Wait for each pipeline unless it ends in '&', in which case it keeps
+ * running in the background. The exit status of each foreground pipeline's
+ * last stage is kept in last_status().
+ * 5. Pipelines joined by '&&&' are collected and handed to run_parallel(),
+ * which runs them concurrently on a bounded number of slots.
+ * 6. A pipeline after '&&' runs only if the one before it succeeded, after
+ * '||' only if it failed; a skipped one leaves `$?` alone. Each command's
+ * variables are expanded (expand_words()) just before it is collected, so
+ * `$?` sees the pipelines before it.
  *
  * @note
  * - The function uses Process objects, which contain information about the
  * command and pipe settings.
  * - It handles sequential execution of commands, considering pipe connections
  * between them.
- * - The function exits with an error message if execvp fails to execute the
- * command.
  * - Make sure to properly manage file descriptors, close unused pipes, and wait
  * for child processes.
  * - The function returns true if a quit command is encountered during
@@ -291,76 +900,60 @@ bool isQuit(Process *p) {
  */
 bool run_commands(list<Process *> &command_list) {
   bool is_quit = false;
-  int max_process = 0;
-  int min_process = 0;
-  int size = command_list.size();
-  pid_t pids[size];
-  Process *prev = nullptr;
+  vector<Process *> stages;           // the pipeline being collected
+  vector<vector<Process *>> group;    // pipelines joined by '&&&'
+
+  Process *last = nullptr;  // last stage of the previous pipeline
+  bool skip = false;        // the pipeline being collected is not run
 
   for(Process* cur: command_list) {
+    // After '&&' or '||' the previous status decides whether this runs.
+    if (stages.empty() && last != nullptr) {
+      skip = (last->and_then && last_status() != 0) ||
+             (last->or_else && last_status() == 0);
+    }
+    if (skip) {
+      if (!cur->pipe_out)
+        last = cur;
+      continue;
+    }
+    expand_words(cur);
     if (isQuit(cur)) {
       is_quit = true;
       break;
     }
-    // if (prev != nullptr && prev->pipe_out && !cur->pipe_in) {
-    //   cout << "ditme doi!!!" << endl;
-    // }
-    
-    if (!cur->pipe_in) {
-      while(min_process < max_process) {
-        waitpid(pids[min_process], NULL, 0); 
-        ++min_process;
-      }
-      if (prev && prev->pipe_out) {
-        close(prev->pipe_fd[0]);
-        close(prev->pipe_fd[1]);
-      }
-      prev = nullptr;
-    }
+    stages.push_back(cur);
+    if (cur->pipe_out)
+      continue;
+    last = cur;
 
-    if (cur->pipe_out) {
-      pipe(cur->pipe_fd); 
-    }
-    pids[max_process++] = fork(); 
-    if (pids[max_process - 1] < 0) { //error 
-      exit(1);
-    }
-    else if (pids[max_process - 1] != 0) { // parent
-      // close(cur->pipe_fd[0]); 
-      // close(cur->pipe_fd[1]); 
-      if (cur->pipe_in && prev) {
-        close(prev->pipe_fd[0]);
-        close(prev->pipe_fd[1]);
+    if (cur->parallel || !group.empty()) {
+      group.push_back(stages);
+      stages.clear();
+      if (!cur->parallel) {
+        run_parallel(group, parallel_settings());
+        glob_cache().forget();
+        group.clear();
       }
+      continue;
     }
-    else { //child
-      // dup2(cur->pipe_fd[1], STDOUT_FILENO);
-      // close(cur->pipe_fd[0]); 
-      // close(cur->pipe_fd[1]); 
-      if (cur->pipe_in && prev) {  //receive input from previous 
-        dup2(prev->pipe_fd[0], STDIN_FILENO); 
-        close(prev->pipe_fd[0]);
-        close(prev->pipe_fd[1]);
-      }
-      if (cur->pipe_out) {
-        dup2(cur->pipe_fd[1], STDOUT_FILENO);
-        close(cur->pipe_fd[0]);
-        close(cur->pipe_fd[1]);
-      }
-      execvp(cur->cmdTokens[0], cur->cmdTokens); 
-      perror("execvp failed");
-    }
-
-    prev = cur; 
+    is_quit = run_pipeline(stages);
+    glob_cache().forget();  // it may have changed what patterns match
+    stages.clear();
+    if (is_quit)
+      break;
   }
-  while(min_process < max_process) {
-    waitpid(pids[min_process], NULL, 0); 
-    ++min_process;
+
+  // Whatever was cut short by quit or a trailing '|' or '&&&' still runs.
+  if (!stages.empty()) {
+    group.push_back(stages);
   }
-  if (prev && prev->pipe_out) {
-    close(prev->pipe_fd[0]);
-    close(prev->pipe_fd[1]);
+  if (group.size() == 1) {
+    is_quit = run_pipeline(group.front()) || is_quit;
+  } else if (!group.empty()) {
+    run_parallel(group, parallel_settings());
   }
+  glob_cache().forget();
   return is_quit;
 }
 
@@ -371,23 +964,79 @@ bool run_commands(list<Process *> &command_list) {
  *
  * @param _pipe_in 1: The process takes input form prev, 0: if not
  * @param _pipe_out 1: The output of current proches is piped to next, 0: if not
+ * @param _arena arena the token array is allocated from; nullptr for the heap
  */
-Process::Process(bool _pipe_in_flag, bool _pipe_out_flag) {
+Process::Process(bool _pipe_in_flag, bool _pipe_out_flag, Arena *_arena) {
   pipe_in = _pipe_in_flag;
   pipe_out = _pipe_out_flag;
+  background = false;
+  parallel = false;
+  and_then = false;
+  or_else = false;
+  cmdTokens = nullptr;
   tok_index = 0;
+  tok_capacity = 0;
+  redirects = nullptr;
+  redirect_count = 0;
+  redirect_capacity = 0;
+  arena = _arena;
 }
 
 /**
  * @brief Destructor for Process class.
+ *
+ * Arena-backed token and redirection arrays are released with the arena.
  */
-Process::~Process() {}
+Process::~Process() {
+  if (arena == nullptr) {
+    free(cmdTokens);
+    free(redirects);
+  }
+}
 
 /**
- * @brief add a pointer to a command or flags to cmdTokens
+ * @brief add a pointer to a command or flags to cmdTokens, growing the array
+ * as needed so there is no limit on the number of arguments.
  *
  * @param tok
  */
 void Process::add_token(char *tok) {
+  if (tok_index == tok_capacity) {
+    int capacity = tok_capacity == 0 ? 8 : tok_capacity * 2;
+    char **tokens;
+    if (arena != nullptr) {
+      tokens = (char **)arena->alloc(sizeof(char *) * capacity, alignof(char *));
+      if (tok_index > 0)
+        memcpy(tokens, cmdTokens, sizeof(char *) * tok_index);
+    } else {
+      tokens = (char **)realloc(cmdTokens, sizeof(char *) * capacity);
+    }
+    cmdTokens = tokens;
+    tok_capacity = capacity;
+  }
   cmdTokens[tok_index++] = tok;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief add a redirection, after the ones already given; like cmdTokens the
+ * array grows as needed.
+ *
+ * @param redirect
+ */
+void Process::add_redirect(const Redirect &redirect) {
+  if (redirect_count == redirect_capacity) {
+    int capacity = redirect_capacity == 0 ? 4 : redirect_capacity * 2;
+    Redirect *grown;
+    if (arena != nullptr) {
+      grown = (Redirect *)arena->alloc(sizeof(Redirect) * capacity,
+                                       alignof(Redirect));
+      if (redirect_count > 0)
+        memcpy(grown, redirects, sizeof(Redirect) * redirect_count);
+    } else {
+      grown = (Redirect *)realloc(redirects, sizeof(Redirect) * capacity);
+    }
+    redirects = grown;
+    redirect_capacity = capacity;
+  }
+  redirects[redirect_count++] = redirect;
+}
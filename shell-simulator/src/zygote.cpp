@@ -0,0 +1,335 @@
+#include <zygote.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// A launch that does not fit in one message takes another backend.
+#define ZYGOTE_MAX_MESSAGE (128 << 10)
+#define ZYGOTE_MAX_FDS 32
+// Received fds are moved at or above this, out of the way of dup2 targets.
+#define ZYGOTE_FD_BASE 64
+
+/**
+ * @brief Header of a launch message, followed by `action_count` FdActions
+ * and then `argc` + `envc` + 2 NUL-terminated strings: the path, argv, the
+ * environment and the working directory.
+ *
+ * Action fds are in the child's numbering. A DUP2 source or TCSETPGRP fd
+ * below zero refers to the (-fd - 1)th fd passed with SCM_RIGHTS instead;
+ * the first three of those are the shell's stdin, stdout and stderr.
+ */
+struct ZygoteRequest {
+  pid_t pgid;
+  uint32_t action_count;
+  uint32_t argc;
+  uint32_t envc;
+};
+
+// Signals a parked child ignores; it puts them back to their defaults (and
+// unblocks everything) just before exec, as launch() does for other backends.
+static const int parked_signals[] = {SIGINT,  SIGQUIT, SIGTSTP,
+                                     SIGTTIN, SIGTTOU, SIGPIPE};
+
+/*** Parked child ***/
+
+static const char *next_string(const char *&cursor, const char *end) {
+  const char *s = cursor;
+  const char *nul = (const char *)memchr(cursor, '\0', end - cursor);
+  if (nul == nullptr)
+    _exit(126);
+  cursor = nul + 1;
+  return s;
+}
+
+/**
+ * @brief Waits for one launch message, replies with its pid, sets itself up
+ * as described and execs. Never returns.
+ */
+static void park(int sock, int note_fd) {
+  static char buffer[ZYGOTE_MAX_MESSAGE];
+  char control[CMSG_SPACE(sizeof(int) * ZYGOTE_MAX_FDS)];
+  struct iovec iov = {buffer, sizeof(buffer)};
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  ssize_t n;
+  do {
+    n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+  } while (n == -1 && errno == EINTR);
+  if (n < (ssize_t)sizeof(ZygoteRequest) ||
+      (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)))
+    _exit(0);  // the shell is gone (or confused): nothing to run
+
+  char note = 1;
+  write(note_fd, &note, 1);
+
+  int fds[ZYGOTE_MAX_FDS];
+  int fd_count = 0;
+  for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c != nullptr;
+       c = CMSG_NXTHDR(&msg, c)) {
+    if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS)
+      continue;
+    int count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    for (int i = 0; i < count && fd_count < ZYGOTE_MAX_FDS; i++) {
+      int fd;
+      memcpy(&fd, CMSG_DATA(c) + i * sizeof(int), sizeof(int));
+      fds[fd_count] = fcntl(fd, F_DUPFD_CLOEXEC, ZYGOTE_FD_BASE);
+      close(fd);
+      fd_count++;
+    }
+  }
+
+  ZygoteRequest request;
+  memcpy(&request, buffer, sizeof(request));
+  const char *cursor = buffer + sizeof(request);
+  const char *end = buffer + n;
+  if (fd_count < 3 || request.action_count * sizeof(FdAction) >
+                          (size_t)(end - cursor))
+    _exit(126);
+  FdAction *actions = (FdAction *)cursor;
+  cursor += request.action_count * sizeof(FdAction);
+  const char *path = next_string(cursor, end);
+  char **argv = new char *[request.argc + 1];
+  for (uint32_t i = 0; i < request.argc; i++)
+    argv[i] = (char *)next_string(cursor, end);
+  argv[request.argc] = nullptr;
+  char **envp = new char *[request.envc + 1];
+  for (uint32_t i = 0; i < request.envc; i++)
+    envp[i] = (char *)next_string(cursor, end);
+  envp[request.envc] = nullptr;
+  const char *cwd = next_string(cursor, end);
+
+  pid_t self = getpid();
+  send(sock, &self, sizeof(self), MSG_NOSIGNAL);
+
+  if (request.pgid >= 0)
+    setpgid(0, request.pgid);
+  for (int fd = 0; fd < 3; fd++)
+    dup2(fds[fd], fd);
+  auto resolve = [&](int fd) {
+    return fd < 0 && -fd - 1 < fd_count ? fds[-fd - 1] : fd;
+  };
+  for (uint32_t i = 0; i < request.action_count; i++) {
+    const FdAction &action = actions[i];
+    if (action.kind == FdAction::DUP2) {
+      dup2(resolve(action.src_fd), action.fd);
+    } else if (action.kind == FdAction::CLOSE) {
+      close(action.fd);
+    } else {
+      tcsetpgrp(resolve(action.fd), getpgrp());  // SIGTTOU is still ignored
+    }
+  }
+
+  if (chdir(cwd) == -1) {
+    perror(cwd);
+    _exit(126);
+  }
+  for (int sig : parked_signals)
+    signal(sig, SIG_DFL);
+  sigset_t none;
+  sigemptyset(&none);
+  sigprocmask(SIG_SETMASK, &none, nullptr);
+  execve(path, argv, envp);
+  if (errno == ENOEXEC) {
+    std::vector<char *> script = script_argv(path, argv);
+    execve(script[0], script.data(), envp);
+  }
+  perror("execve failed");
+  _exit(126);
+}
+
+/*** Zygote ***/
+
+// Parks one more child. CLONE_PARENT makes it a sibling of the zygote, i.e.
+// a child of the shell, which reaps it like any other.
+static void park_one(int sock, int note_fd) {
+  if (syscall(SYS_clone, CLONE_PARENT | SIGCHLD, 0, 0, 0, 0) == 0)
+    park(sock, note_fd);
+}
+
+static void run_zygote(int sock, int notes[2], pid_t shell) {
+  prctl(PR_SET_PDEATHSIG, SIGKILL);
+  if (getppid() != shell)
+    _exit(0);
+  for (int sig : parked_signals)
+    signal(sig, SIG_IGN);
+  sigset_t none;
+  sigemptyset(&none);
+  sigprocmask(SIG_SETMASK, &none, nullptr);
+  // Nothing the shell had open may leak into the commands.
+  close_range(3, ~0U, CLOSE_RANGE_CLOEXEC);
+
+  const char *env = getenv("TSH_ZYGOTE_CHILDREN");
+  int parked = env != nullptr && atoi(env) > 0 ? atoi(env) : 2;
+  for (int i = 0; i < parked; i++)
+    park_one(sock, notes[1]);
+
+  char consumed[64];
+  while (true) {
+    ssize_t n = read(notes[0], consumed, sizeof(consumed));
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      _exit(0);
+    for (ssize_t i = 0; i < n; i++)
+      park_one(sock, notes[1]);
+  }
+}
+
+Zygote &zygote() {
+  static Zygote instance;
+  return instance;
+}
+
+Zygote::Zygote() : sock(-1), pid(-1), failed(false) {}
+
+/**
+ * @brief Forks the zygote unless it is already running. Starting it while
+ * the shell is still small (main() does when the zygote is the backend)
+ * keeps its own forks cheap.
+ * @return whether the zygote is available
+ */
+bool Zygote::start() {
+  if (sock != -1 || failed)
+    return !failed;
+  int fds[2], notes[2];
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) == -1) {
+    failed = true;
+    return false;
+  }
+  if (pipe2(notes, O_CLOEXEC) == -1) {
+    close(fds[0]);
+    close(fds[1]);
+    failed = true;
+    return false;
+  }
+  pid_t shell = getpid();
+  fflush(stdout);
+  fflush(stderr);
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(fds[0]);
+    run_zygote(fds[1], notes, shell);
+  }
+  close(fds[1]);
+  close(notes[0]);
+  close(notes[1]);
+  if (pid == -1) {
+    close(fds[0]);
+    failed = true;
+    return false;
+  }
+  this->pid = pid;
+  sock = fds[0];
+  return true;
+}
+
+/**
+ * @brief Hands spec to a parked child. Actions are rewritten into the
+ * child's fd numbering: fds the child does not have yet (the shell's stdio
+ * and any other DUP2 source) are passed along, and closing an fd the child
+ * never had is dropped.
+ */
+pid_t Zygote::launch(const LaunchSpec &spec) {
+  if (!start() || kill(pid, 0) == -1)
+    return -2;
+
+  std::vector<int> pass = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+  bool live[ZYGOTE_FD_BASE] = {true, true, true};
+  std::vector<FdAction> actions;
+  auto child_fd = [&](int fd) {
+    if (fd >= 0 && fd < ZYGOTE_FD_BASE && live[fd])
+      return fd;
+    pass.push_back(fd);
+    return -(int)pass.size();
+  };
+  for (const FdAction &action : spec.actions) {
+    if (action.fd < 0 || action.fd >= ZYGOTE_FD_BASE)
+      return -2;
+    if (action.kind == FdAction::DUP2) {
+      actions.push_back({FdAction::DUP2, action.fd, child_fd(action.src_fd)});
+      live[action.fd] = true;
+    } else if (action.kind == FdAction::CLOSE) {
+      if (live[action.fd])
+        actions.push_back(action);
+      live[action.fd] = false;
+    } else {
+      actions.push_back({FdAction::TCSETPGRP, child_fd(action.fd), -1});
+    }
+  }
+  if (pass.size() > ZYGOTE_MAX_FDS)
+    return -2;
+
+  char cwd[PATH_MAX];
+  if (getcwd(cwd, sizeof(cwd)) == nullptr)
+    return -2;
+  ZygoteRequest request = {spec.pgid, (uint32_t)actions.size(), 0, 0};
+  std::string strings(spec.path);
+  strings += '\0';
+  for (char **arg = spec.argv; *arg != nullptr; arg++, request.argc++) {
+    strings += *arg;
+    strings += '\0';
+  }
+  for (char **var = environ; *var != nullptr; var++, request.envc++) {
+    strings += *var;
+    strings += '\0';
+  }
+  strings += cwd;
+  strings += '\0';
+  size_t action_bytes = actions.size() * sizeof(FdAction);
+  if (sizeof(request) + action_bytes + strings.size() > ZYGOTE_MAX_MESSAGE)
+    return -2;
+
+  struct iovec iov[3] = {{&request, sizeof(request)},
+                         {actions.data(), action_bytes},
+                         {&strings[0], strings.size()}};
+  char control[CMSG_SPACE(sizeof(int) * ZYGOTE_MAX_FDS)];
+  memset(control, 0, sizeof(control));
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = 3;
+  msg.msg_control = control;
+  msg.msg_controllen = CMSG_SPACE(sizeof(int) * pass.size());
+  struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+  c->cmsg_level = SOL_SOCKET;
+  c->cmsg_type = SCM_RIGHTS;
+  c->cmsg_len = CMSG_LEN(sizeof(int) * pass.size());
+  memcpy(CMSG_DATA(c), pass.data(), sizeof(int) * pass.size());
+
+  ssize_t n;
+  do {
+    n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+  } while (n == -1 && errno == EINTR);
+  if (n == -1) {
+    if (errno == EBADF) {
+      return -1;  // one of spec's fds is not open; the same for any backend
+    }
+    failed = true;
+    return -2;
+  }
+
+  pid_t pid;
+  do {
+    n = recv(sock, &pid, sizeof(pid), 0);
+  } while (n == -1 && errno == EINTR);
+  if (n != sizeof(pid)) {
+    failed = true;
+    return -1;
+  }
+  return pid;
+}
@@ -1,5 +1,6 @@
 #include <fcntl.h>
 #include <gtest/gtest.h>
+#include <limits.h>
 #include <tsh.h>
 #include <unistd.h>
 #include <ctime>
@@ -101,6 +102,511 @@ TEST(ShellTest, TestSimpleRun) {
                                          << expected_output;
 }
 
+// test parsing splits in place and has no argument limit
+TEST(ShellTest, ParseManyTokens) {
+  string line = "echo";
+  for (int i = 0; i < 200; i++) line += " arg" + to_string(i);
+  line += " | wc -w ; ls";
+  vector<char> buf(line.begin(), line.end());
+  buf.push_back('\0');
+
+  list<Process *> process_list;
+  parse_input(buf.data(), process_list);
+  ASSERT_EQ(process_list.size(), 3u);
+
+  Process *echo = process_list.front();
+  EXPECT_EQ(echo->tok_index, 202) << "echo + 200 args + terminating nullptr";
+  EXPECT_STREQ(echo->cmdTokens[200], "arg199");
+  EXPECT_EQ(echo->cmdTokens[201], nullptr);
+  EXPECT_TRUE(echo->cmdTokens[1] >= buf.data() &&
+              echo->cmdTokens[1] < buf.data() + buf.size())
+      << "tokens should point into the input line";
+  EXPECT_TRUE(echo->pipe_out);
+  EXPECT_TRUE((*next(process_list.begin()))->pipe_in);
+  EXPECT_FALSE(process_list.back()->pipe_in);
+
+  for (Process *p : process_list) p->~Process();
+  process_list.clear();
+  line_arena().reset();
+}
+// test the command hash table resolves names and follows PATH changes
+TEST(ShellTest, PathCacheLookup) {
+  PathCache cache;
+  string path;
+  string old_path = getenv("PATH") ? getenv("PATH") : "";
+
+  setenv("PATH", "/nonexistent:/bin:/usr/bin", 1);
+  ASSERT_TRUE(cache.lookup("sh", path));
+  EXPECT_EQ(path[0], '/') << "expected an absolute path, got " << path;
+  EXPECT_FALSE(cache.lookup("no-such-command-tsh", path));
+
+  setenv("PATH", "/nonexistent", 1);
+  EXPECT_FALSE(cache.lookup("sh", path)) << "PATH change should drop the table";
+
+  EXPECT_TRUE(cache.lookup("/bin/sh", path));
+  EXPECT_EQ(path, "/bin/sh");
+  setenv("PATH", old_path.c_str(), 1);
+
+  // A script without #! runs under /bin/sh, as with execvp().
+  write_line("/tmp/tsh_noshebang", "echo script $1\n");
+  ASSERT_EQ(chmod("/tmp/tsh_noshebang", 0755), 0);
+  char line[] = "/tmp/tsh_noshebang arg";
+  list<Process *> process_list;
+  parse_input(line, process_list);
+  testing::internal::CaptureStdout();
+  run_commands(process_list);
+  string output = testing::internal::GetCapturedStdout();
+  cleanup(process_list, nullptr);
+  remove("/tmp/tsh_noshebang");
+  EXPECT_EQ(output, "script arg\n");
+  EXPECT_EQ(last_status(), 0);
+}
+
+// test builtins run in the shell on their own and in a child in a pipeline
+TEST(ShellTest, BuiltinsInProcessAndInPipeline) {
+  char old_cwd[PATH_MAX];
+  ASSERT_NE(getcwd(old_cwd, sizeof(old_cwd)), nullptr);
+
+  char line[] = "cd /tmp ; false";
+  list<Process *> process_list;
+  parse_input(line, process_list);
+  EXPECT_FALSE(run_commands(process_list));
+  char cwd[PATH_MAX];
+  ASSERT_NE(getcwd(cwd, sizeof(cwd)), nullptr);
+  EXPECT_STREQ(cwd, "/tmp") << "cd should change the shell's own directory";
+  EXPECT_EQ(last_status(), 1);
+  cleanup(process_list, nullptr);
+
+  char piped[] = "cd / | echo piped $? | tr a-z A-Z ; pwd";
+  parse_input(piped, process_list);
+  testing::internal::CaptureStdout();
+  run_commands(process_list);
+  string output = testing::internal::GetCapturedStdout();
+  EXPECT_EQ(output, "PIPED 1\n/tmp\n")
+      << "a builtin in a pipeline writes into the pipe and runs in a child";
+  EXPECT_EQ(last_status(), 0);
+  cleanup(process_list, nullptr);
+
+  ASSERT_EQ(chdir(old_cwd), 0);
+}
+
+// test script text runs line by line in place, with comments and no prompt
+TEST(ShellTest, RunLinesScript) {
+  char script[] = "#!/bin/tsh\n  # comment\necho one\nfalse\necho $?\n"
+                  "exit 5\necho unreachable";
+  interactive() = false;
+  testing::internal::CaptureStdout();
+  bool quit = run_lines(script, strlen(script));
+  string output = testing::internal::GetCapturedStdout();
+  interactive() = true;
+
+  EXPECT_TRUE(quit);
+  EXPECT_EQ(output, "one\n1\n");
+  EXPECT_EQ(last_status(), 5);
+  exit_requested() = false;
+}
+
+// test '&' leaves a pipeline running while later commands go ahead
+TEST(ShellTest, BackgroundJobsAndWait) {
+  char line[] = "sleep 5 | true & false";
+  list<Process *> process_list;
+  parse_input(line, process_list);
+  ASSERT_EQ(process_list.size(), 3u);
+  EXPECT_TRUE((*next(process_list.begin()))->background);
+
+  run_commands(process_list);
+  cleanup(process_list, nullptr);
+  EXPECT_EQ(last_status(), 1);
+
+  Job *job = job_table().current();
+  ASSERT_NE(job, nullptr);
+  EXPECT_EQ(job->command, "sleep 5 | true &");
+  EXPECT_EQ(job->pids.size(), 2u);
+  job_table().update();
+  EXPECT_EQ(job->state, JOB_RUNNING)
+      << "the foreground command should not wait for the background job";
+  kill(job->pids[0], SIGTERM);
+
+  char wait_line[] = "wait";
+  parse_input(wait_line, process_list);
+  run_commands(process_list);
+  cleanup(process_list, nullptr);
+  EXPECT_TRUE(job_table().empty()) << "finished jobs should be reaped";
+  EXPECT_EQ(waitpid(-1, nullptr, WNOHANG), -1) << "no zombies left behind";
+}
+
+// test '&&&' runs pipelines concurrently on a bounded pool
+TEST(ShellTest, ParallelPool) {
+  ParallelSettings saved = parallel_settings();
+  parallel_settings() = {2, true};
+
+  char line[] =
+      "sleep 0.2 &&& sleep 0.2 &&& sleep 0.2 &&& echo one | tr a-z A-Z";
+  list<Process *> process_list;
+  parse_input(line, process_list);
+  ASSERT_EQ(process_list.size(), 5u);
+  EXPECT_TRUE(process_list.front()->parallel);
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  testing::internal::CaptureStdout();
+  run_commands(process_list);
+  string output = testing::internal::GetCapturedStdout();
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  cleanup(process_list, nullptr);
+  double elapsed =
+      end.tv_sec - start.tv_sec + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+  EXPECT_EQ(output, "ONE\n");
+  EXPECT_GE(elapsed, 0.4) << "only 2 of the 3 sleeps may overlap";
+  EXPECT_EQ(last_status(), 0);
+  EXPECT_TRUE(job_table().empty());
+
+  // Each side waits (up to 5 s) for the other to have started: both succeed
+  // only if the two jobs really run at the same time.
+  write_line("/tmp/tsh_meet",
+             "#!/bin/sh\ntouch /tmp/tsh_meet.$1\nfor i in $(seq 500); do\n"
+             "  [ -e /tmp/tsh_meet.$2 ] && exit 0\n  sleep 0.01\ndone\nexit 1\n");
+  ASSERT_EQ(chmod("/tmp/tsh_meet", 0755), 0);
+  char meet[] = "/tmp/tsh_meet a b &&& /tmp/tsh_meet b a";
+  parse_input(meet, process_list);
+  run_commands(process_list);
+  cleanup(process_list, nullptr);
+  EXPECT_EQ(last_status(), 0) << "2 slots should run both jobs at once";
+  remove("/tmp/tsh_meet");
+  remove("/tmp/tsh_meet.a");
+  remove("/tmp/tsh_meet.b");
+
+  char failing[] = "parallel -j 3 false ::: a b c";
+  parse_input(failing, process_list);
+  run_commands(process_list);
+  cleanup(process_list, nullptr);
+  EXPECT_EQ(last_status(), 3) << "status counts the failed jobs";
+  parallel_settings() = saved;
+}
+
+// test redirections are recorded in order and wired into the command's fds
+TEST(ShellTest, Redirections) {
+  char parse_line[] = "sort -r < in.txt 2>&1 >> out.txt 2>err.txt | wc";
+  list<Process *> process_list;
+  parse_input(parse_line, process_list);
+  ASSERT_EQ(process_list.size(), 2u);
+  Process *sort = process_list.front();
+  EXPECT_EQ(sort->tok_index, 3) << "sort -r and the terminating nullptr";
+  ASSERT_EQ(sort->redirect_count, 4);
+  EXPECT_EQ(sort->redirects[0].kind, Redirect::READ);
+  EXPECT_STREQ(sort->redirects[0].target, "in.txt");
+  EXPECT_EQ(sort->redirects[1].kind, Redirect::DUP);
+  EXPECT_EQ(sort->redirects[1].fd, 2);
+  EXPECT_EQ(sort->redirects[1].src_fd, 1);
+  EXPECT_EQ(sort->redirects[2].kind, Redirect::APPEND);
+  EXPECT_EQ(sort->redirects[3].fd, 2);
+  EXPECT_STREQ(sort->redirects[3].target, "err.txt");
+  cleanup(process_list, nullptr);
+
+  char line[] =
+      "echo b > redir.txt ; echo a >> redir.txt ; sort < redir.txt > sorted.txt"
+      " ; ls /nonexistent-tsh 2> err.txt ; cat sorted.txt err.txt | wc -l";
+  parse_input(line, process_list);
+  testing::internal::CaptureStdout();
+  run_commands(process_list);
+  string output = testing::internal::GetCapturedStdout();
+  cleanup(process_list, nullptr);
+  EXPECT_EQ(output, "3\n");
+
+  ifstream sorted("sorted.txt");
+  string first;
+  getline(sorted, first);
+  EXPECT_EQ(first, "a");
+
+  // A lone builtin cat runs in a child, where Ctrl-C can still stop it.
+  char lone[] = "time cat sorted.txt > copy.txt";
+  parse_input(lone, process_list);
+  testing::internal::CaptureStderr();
+  run_commands(process_list);
+  string report = testing::internal::GetCapturedStderr();
+  cleanup(process_list, nullptr);
+  EXPECT_NE(report.find("cat"), string::npos);
+  EXPECT_EQ(report.find("(builtin)"), string::npos) << report;
+  ifstream copy("copy.txt");
+  getline(copy, first);
+  EXPECT_EQ(first, "a");
+  remove("copy.txt");
+
+  char missing[] = "cat < no-such-file.txt";
+  parse_input(missing, process_list);
+  run_commands(process_list);
+  cleanup(process_list, nullptr);
+  EXPECT_EQ(last_status(), 1) << "a failed redirection is the shell's error";
+  remove("redir.txt");
+  remove("sorted.txt");
+  remove("err.txt");
+}
+
+TEST(ShellTest, ResourceAccounting) {
+  list<Process *> process_list;
+  setenv("TSH_STATS_LOG", "stats.log", 1);
+  char line[] = "time sleep 0.1 | true ; time echo hi > /dev/null";
+  parse_input(line, process_list);
+  testing::internal::CaptureStderr();
+  run_commands(process_list);
+  string report = testing::internal::GetCapturedStderr();
+  cleanup(process_list, nullptr);
+  unsetenv("TSH_STATS_LOG");
+
+  EXPECT_NE(report.find("sleep"), string::npos);
+  EXPECT_NE(report.find("echo (builtin)"), string::npos);
+  EXPECT_NE(report.find("real "), string::npos);
+
+  ifstream log("stats.log");
+  string entry;
+  double sleep_wall = 0;
+  int lines = 0;
+  while (getline(log, entry)) {
+    lines++;
+    if (entry.find("\"command\":\"sleep\"") != string::npos) {
+      size_t at = entry.find("\"wall\":");
+      sleep_wall = atof(entry.c_str() + at + 7);
+    }
+  }
+  EXPECT_EQ(lines, 3);
+  EXPECT_GE(sleep_wall, 0.1);
+  remove("stats.log");
+}
+
+TEST(ShellTest, ZygoteBackend) {
+  SpawnBackend saved = spawn_backend();
+  set_spawn_backend(SPAWN_ZYGOTE);
+  char cwd[PATH_MAX];
+  ASSERT_NE(getcwd(cwd, sizeof(cwd)), nullptr);
+
+  list<Process *> process_list;
+  char line[] =
+      "export ZYGOTE_TEST=seen ; printenv ZYGOTE_TEST ; cd / ; /bin/pwd ;"
+      " echo a b | tr a-z A-Z > /tmp/tsh_zygote.txt ;"
+      " wc -c < /tmp/tsh_zygote.txt ; ls /nonexistent-tsh 2>&1 | wc -l";
+  parse_input(line, process_list);
+  testing::internal::CaptureStdout();
+  run_commands(process_list);
+  string output = testing::internal::GetCapturedStdout();
+  cleanup(process_list, nullptr);
+  ASSERT_EQ(chdir(cwd), 0);
+  unsetenv("ZYGOTE_TEST");
+  remove("/tmp/tsh_zygote.txt");
+  set_spawn_backend(saved);
+
+  EXPECT_EQ(output, "seen\n/\n4\n1\n");
+  EXPECT_EQ(last_status(), 0);
+}
+
+TEST(ShellTest, DaemonFraming) {
+  string socket_path = "/tmp/tsh_test." + to_string(getpid()) + ".sock";
+  pid_t daemon = fork();
+  if (daemon == 0)
+    _exit(run_server(socket_path.c_str()));
+
+  int fd = -1;
+  for (int tries = 0; tries < 100 && fd == -1; tries++) {
+    usleep(10000);
+    fd = connect_server(socket_path.c_str());
+  }
+  ASSERT_NE(fd, -1);
+
+  // Two requests in flight at once; the slow one is sent first.
+  string slow = "sleep 0.2 ; echo slow";
+  string fast = "echo out ; ls /nonexistent-tsh ; exit 3";
+  ASSERT_TRUE(write_frame(fd, FRAME_RUN, 1, slow.data(), slow.size()));
+  ASSERT_TRUE(write_frame(fd, FRAME_RUN, 2, fast.data(), fast.size()));
+
+  FrameReader reader(fd);
+  FrameHeader header;
+  string payload;
+  map<uint32_t, string> out, err;
+  vector<uint32_t> finished;
+  map<uint32_t, int32_t> status;
+  while (finished.size() < 2 && read_frame(reader, header, payload)) {
+    if (header.type == FRAME_STDOUT) {
+      out[header.id] += payload;
+    } else if (header.type == FRAME_STDERR) {
+      err[header.id] += payload;
+    } else if (header.type == FRAME_EXIT) {
+      memcpy(&status[header.id], payload.data(), sizeof(int32_t));
+      finished.push_back(header.id);
+    }
+  }
+  close(fd);
+
+  // An oversized frame is refused from its header alone: its request fails
+  // and the connection is read no further.
+  fd = connect_server(socket_path.c_str());
+  ASSERT_NE(fd, -1);
+  FrameHeader huge = {FRAME_RUN, 7, MAX_FRAME_PAYLOAD + 10};
+  ASSERT_EQ(write(fd, &huge, sizeof(huge)), (ssize_t)sizeof(huge));
+  ASSERT_TRUE(write_frame(fd, FRAME_RUN, 8, fast.data(), fast.size()));
+  FrameReader refused(fd);
+  vector<uint32_t> answered;
+  int32_t huge_status = -1;
+  while (read_frame(refused, header, payload)) {
+    answered.push_back(header.id);
+    if (header.type == FRAME_EXIT && header.id == 7)
+      memcpy(&huge_status, payload.data(), sizeof(int32_t));
+  }
+  close(fd);
+  kill(daemon, SIGTERM);
+  waitpid(daemon, nullptr, 0);
+  unlink(socket_path.c_str());
+
+  EXPECT_EQ(answered, vector<uint32_t>{7});
+  EXPECT_EQ(huge_status, 126);
+  ASSERT_EQ(finished.size(), 2u);
+  EXPECT_EQ(finished[0], 2u) << "a running pipeline holds nobody up";
+  EXPECT_EQ(out[1], "slow\n");
+  EXPECT_EQ(status[1], 0);
+  EXPECT_EQ(out[2], "out\n");
+  EXPECT_NE(err[2].find("nonexistent-tsh"), string::npos);
+  EXPECT_EQ(status[2], 3);
+}
+
+// test pipefail and per-pipeline deadlines, and that a pipeline finishes
+// with its last stage however the stages before it end
+TEST(ShellTest, PipelineSupervisor) {
+  char script[] =
+      "false | true\necho $?\nset -o pipefail\nfalse | true\necho $?\n"
+      "true | false | true\necho $?\nyes | head -1\necho $?\n"
+      "set +o pipefail\nyes | head -1\necho $?\n";
+  interactive() = false;
+  testing::internal::CaptureStdout();
+  run_lines(script, strlen(script));
+  string output = testing::internal::GetCapturedStdout();
+  EXPECT_EQ(output, "0\n1\n1\ny\n141\ny\n0\n");
+  EXPECT_FALSE(pipefail());
+
+  setenv("TSH_TIMEOUT", "0.2", 1);
+  char slow[] = "sleep 5 | sleep 5\n";
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  testing::internal::CaptureStderr();
+  run_lines(slow, strlen(slow));
+  string report = testing::internal::GetCapturedStderr();
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  unsetenv("TSH_TIMEOUT");
+  interactive() = true;
+
+  EXPECT_EQ(last_status(), 124);
+  EXPECT_NE(report.find("timed out"), string::npos);
+  EXPECT_LT(end.tv_sec - start.tv_sec + (end.tv_nsec - start.tv_nsec) / 1e9,
+            1.0)
+      << "SIGTERM should end the pipeline at its deadline";
+  EXPECT_TRUE(job_table().empty());
+
+  // A background job's deadline is kept while the shell waits for a
+  // foreground job: it times out before that job writes "late".
+  write_line("/tmp/tsh_late", "#!/bin/sh\nsleep 0.5\necho late >&2\n");
+  ASSERT_EQ(chmod("/tmp/tsh_late", 0755), 0);
+  char background[] = "sleep 5 &\n";
+  char late[] = "/tmp/tsh_late\n";
+  interactive() = false;
+  setenv("TSH_TIMEOUT", "0.2", 1);
+  run_lines(background, strlen(background));
+  unsetenv("TSH_TIMEOUT");
+  testing::internal::CaptureStderr();
+  run_lines(late, strlen(late));
+  report = testing::internal::GetCapturedStderr();
+  remove("/tmp/tsh_late");
+  EXPECT_NE(report.find("timed out: sleep 5 &"), string::npos) << report;
+  EXPECT_LT(report.find("timed out"), report.find("late\n")) << report;
+  job_table().wait_all();
+
+  // ... and while it waits for input: stdin is a pipe written after 0.5 s.
+  int input[2];
+  ASSERT_EQ(pipe(input), 0);
+  int saved_stdin = dup(STDIN_FILENO);
+  dup2(input[0], STDIN_FILENO);
+  close(input[0]);
+  char background_again[] = "sleep 5 &\n";  // run_lines() splits in place
+  setenv("TSH_TIMEOUT", "0.2", 1);
+  run_lines(background_again, strlen(background_again));
+  unsetenv("TSH_TIMEOUT");
+  pid_t writer = fork();
+  if (writer == 0) {
+    usleep(500000);
+    _exit(write(input[1], "x\n", 2) == 2 ? 0 : 1);
+  }
+  close(input[1]);
+  testing::internal::CaptureStderr();
+  char *typed = read_input();
+  report = testing::internal::GetCapturedStderr();
+  waitpid(writer, nullptr, 0);
+  dup2(saved_stdin, STDIN_FILENO);
+  close(saved_stdin);
+  clearerr(stdin);
+  interactive() = true;
+  ASSERT_NE(typed, nullptr);
+  EXPECT_STREQ(typed, "x\n");
+  free(typed);
+  EXPECT_NE(report.find("timed out: sleep 5 &"), string::npos) << report;
+  job_table().wait_all();
+  EXPECT_TRUE(job_table().empty());
+}
+
+// test variables, &&/|| and for/while/if, including blocks spanning lines
+TEST(ShellTest, ControlFlow) {
+  char script[] =
+      "N=3 ; V=x\n"
+      "true && echo and || echo or ; false && echo no || echo $V$N\n"
+      "for i in a b ; do echo -n $i ; done ; echo\n"
+      "while [ $N != 0 ]\ndo\n"
+      "  if [ $N = 3 ]; then N=2; elif [ $N = 2 ]; then N=1\n"
+      "  else N=0; fi\n"
+      "  echo -n $N\ndone\necho\n"
+      "until true; do echo never; done\n"
+      "for x in done fi; do echo $x; done\n"
+      "if false; then echo a; fi\necho $?\n"
+      "for i in 1; do\n  fi\ndone\necho $?\n";
+  interactive() = false;
+  testing::internal::CaptureStdout();
+  testing::internal::CaptureStderr();
+  run_lines(script, strlen(script));
+  string output = testing::internal::GetCapturedStdout();
+  string errors = testing::internal::GetCapturedStderr();
+  interactive() = true;
+
+  EXPECT_EQ(output, "and\nx3\nab\n210\ndone\nfi\n0\n2\n");
+  EXPECT_NE(errors.find("syntax error near unexpected token `fi'"),
+            string::npos);
+  EXPECT_STREQ(get_variable("i", 1), "b") << "nothing of a bad block runs";
+}
+
+// test pathname expansion: sorted matches, `**`, hidden files, no match
+TEST(ShellTest, GlobExpansion) {
+  char cwd[PATH_MAX];
+  ASSERT_NE(getcwd(cwd, sizeof(cwd)), nullptr);
+  system("rm -rf /tmp/tsh_glob && mkdir -p /tmp/tsh_glob/d/e && cd "
+         "/tmp/tsh_glob && touch b.log a.log .h.log c.txt d/x.log d/e/y.log");
+  ASSERT_EQ(chdir("/tmp/tsh_glob"), 0);
+
+  char script[] =
+      "echo *.log ; echo ?.txt [ab].log ; echo **/*.log ; echo */\n"
+      "echo none*.log ; P=d/*.log ; echo $P\n"
+      "for f in *.log ; do echo -n $f: ; done ; echo\n"
+      "echo *.new ; touch n.new ; echo *.new ; rm n.new ; echo *.new\n"
+      "echo *.log ; cd d ; echo *.log ; cd .. ; echo *.log\n";
+  interactive() = false;
+  testing::internal::CaptureStdout();
+  run_lines(script, strlen(script));
+  string output = testing::internal::GetCapturedStdout();
+  interactive() = true;
+  ASSERT_EQ(chdir(cwd), 0);
+  system("rm -rf /tmp/tsh_glob");
+
+  EXPECT_EQ(output,
+            "a.log b.log\nc.txt a.log b.log\n"
+            "a.log b.log d/e/y.log d/x.log\nd/\nnone*.log\nd/x.log\n"
+            "a.log:b.log:\n"
+            "*.new\nn.new\n*.new\n"
+            "a.log b.log\nx.log\na.log b.log\n")
+      << "each command sees the files and directory earlier ones left";
+}
 
 int main(int argc, char **argv) {
   testing::InitGoogleTest(&argc, argv);
@@ -3,8 +3,13 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <errno.h>
+#include <string.h>
+#include <sys/uio.h>
 #include "io_helpers.h"
 
+#define FRAME_BUFFER_SIZE 4096  //initial buffer of a FrameReader
+#define FRAME_SPILL_SIZE 65536  //the most one fill_frames() reads past the buffer
+
 ssize_t write_all(int fd, const void *buf, size_t count) {
     size_t total = 0;
     const char *ptr = buf;
@@ -22,27 +27,133 @@ ssize_t write_all(int fd, const void *buf, size_t count) {
     return total;
 }
 
-char* read_all(int fd) {
-    char *buffer = malloc(128 * sizeof(char));
+// Sends the header and payload with one writev(), or copies both into ring
+// and wakes its consumer through fd if it sleeps. A pipe that takes only part
+// of them gets the rest through write_all().
+ssize_t write_frame(int fd, Ring *ring, uint32_t type, int32_t task_id, const void *payload, uint32_t length) {
+    FrameHeader header = { type, task_id, length };
+    struct iovec iov[2] = {
+        { &header, sizeof(header) },
+        { (void *)payload, length },
+    };
+    size_t total = sizeof(header) + length;
+    if (ring != NULL)
+        return ring_write(ring, fd, iov, 2);
 
-    int total = 0;
-    while (1) {
-        ssize_t n = read(fd, buffer + total, 128);
-        if (n == -1) {
-            if (errno == EINTR) continue;  // Retry on interrupt
-            perror("read failed");
-            free(buffer);
-            return NULL;
-        }
+    ssize_t n;
+    do {
+        n = writev(fd, iov, 2);
+    } while (n == -1 && errno == EINTR);
+    if (n == -1) {
+        perror("writev failed");
+        return -1;
+    }
+
+    size_t sent = n;
+    if (sent < sizeof(header)) {
+        if (write_all(fd, (char *)&header + sent, sizeof(header) - sent) == -1)
+            return -1;
+        sent = sizeof(header);
+    }
+    if (sent < total &&
+        write_all(fd, (const char *)payload + (sent - sizeof(header)), total - sent) == -1)
+        return -1;
+    return total;
+}
+
+void frame_reader_init(FrameReader *reader, int fd, Ring *ring) {
+    reader->fd = fd;
+    reader->ring = ring;
+    reader->capacity = FRAME_BUFFER_SIZE;
+    reader->data = malloc(reader->capacity);
+    if (reader->data == NULL) {
+        perror("malloc frame buffer");
+        exit(EXIT_FAILURE);
+    }
+    reader->start = reader->end = 0;
+}
 
-        if (n == 0) {
-            free(buffer);
-            return NULL; //write-end close the pipe
+void frame_reader_free(FrameReader *reader) {
+    free(reader->data);
+    reader->data = NULL;
+}
+
+// Reads whatever the fd has with a single readv(): into the free end of the
+// buffer and, past that, into a spill area that is appended after growing the
+// buffer. A ring is copied from straight into the buffer, grown first if
+// nearly full. Returns the bytes read, 0 at EOF, -1 on error (errno EAGAIN if
+// there is nothing to read yet).
+ssize_t fill_frames(FrameReader *reader) {
+    //keep only the partial frame left over; it moves to the front
+    if (reader->start > 0) {
+        memmove(reader->data, reader->data + reader->start, reader->end - reader->start);
+        reader->end -= reader->start;
+        reader->start = 0;
+    }
+
+    if (reader->ring != NULL) {
+        if (reader->capacity - reader->end < FRAME_BUFFER_SIZE) {
+            reader->capacity *= 2;
+            reader->data = realloc(reader->data, reader->capacity);
+            if (reader->data == NULL) {
+                perror("realloc frame buffer");
+                exit(EXIT_FAILURE);
+            }
         }
+        ssize_t n = ring_read(reader->ring, reader->fd, reader->data + reader->end,
+                              reader->capacity - reader->end);
+        if (n > 0)
+            reader->end += n;
+        else if (n == -1 && errno != EAGAIN)
+            perror("ring read failed");
+        return n;
+    }
 
-        total += n;
-        if (buffer[total - 1] == '\0') break; 
+    char spill[FRAME_SPILL_SIZE];
+    struct iovec iov[2] = {
+        { reader->data + reader->end, reader->capacity - reader->end },
+        { spill, sizeof(spill) },
+    };
+    ssize_t n;
+    do {
+        n = readv(reader->fd, iov, 2);
+    } while (n == -1 && errno == EINTR);
+    if (n == -1) {
+        if (errno != EAGAIN)
+            perror("read failed");
+        return -1;
     }
 
-    return buffer;
-}
\ No newline at end of file
+    size_t room = reader->capacity - reader->end;
+    if ((size_t)n > room) {
+        size_t needed = reader->end + n;
+        while (reader->capacity < needed)
+            reader->capacity *= 2;
+        reader->data = realloc(reader->data, reader->capacity);
+        if (reader->data == NULL) {
+            perror("realloc frame buffer");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(reader->data + reader->end + room, spill, n - room);
+    }
+    reader->end += n;
+    return n;
+}
+
+// Returns the next complete frame already in the buffer: 1 with `payload`
+// pointing into the buffer (valid until the next fill_frames()), 0 if more
+// bytes are needed, -1 if the stream is corrupt.
+int next_frame(FrameReader *reader, FrameHeader *header, const char **payload) {
+    size_t available = reader->end - reader->start;
+    if (available < sizeof(*header))
+        return 0;
+    memcpy(header, reader->data + reader->start, sizeof(*header));
+    if (header->length > FRAME_MAX_PAYLOAD)
+        return -1;
+    if (available - sizeof(*header) < header->length)
+        return 0;
+
+    *payload = reader->data + reader->start + sizeof(*header);
+    reader->start += sizeof(*header) + header->length;
+    return 1;
+}
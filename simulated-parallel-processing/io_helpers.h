@@ -1,10 +1,62 @@
 #ifndef IO_HELPERS_H
 #define IO_HELPERS_H
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include "ring.h"
+
+// Every message between main and a core is a frame: a FrameHeader followed by
+// `length` bytes of payload. Frames are binary and back to back on the pipe,
+// so one read can bring several of them.
+typedef struct {
+    uint32_t type;      // one of the FRAME_* values below
+    int32_t task_id;
+    uint32_t length;    // payload bytes after the header
+} FrameHeader;
+
+// A frame carries a batch: the tasks task_id, task_id + 1, ... and, in the
+// answer, their results in the same order.
+enum {
+    FRAME_BITS_TASK = 1,   // payload: int32_t n per task, the number of leftmost bits to keep
+    FRAME_CACHE_TASK,      // payload: int32_t count, count CacheTasks, then the trace path (not NUL-terminated)
+    FRAME_BITS_RESULT,     // payload: int32_t value per task
+    FRAME_CACHE_RESULT,    // payload: CacheResult per task
+};
+
+typedef struct {
+    int32_t set_bits;
+    int32_t lines;
+    int32_t block_bits;
+} CacheTask;
+
+typedef struct {
+    int32_t hits;
+    int32_t cold;
+    int32_t conflict;
+    int32_t error;      // errno of why the simulation could not run, 0 if it did
+} CacheResult;
+
+// A longer payload means the stream is corrupt.
+#define FRAME_MAX_PAYLOAD (1 << 20)
+
+// Buffered reader of the frames arriving on one fd, or in a ring whose
+// consumer sleeps on the eventfd `fd`.
+typedef struct {
+    int fd;
+    Ring *ring;     // NULL when fd is a pipe
+    char *data;
+    size_t capacity;
+    size_t start;   // first byte not yet returned by next_frame()
+    size_t end;     // one past the last byte read
+} FrameReader;
 
 ssize_t write_all(int fd, const void *buf, size_t count);
-char* read_all(int fd);
+ssize_t write_frame(int fd, Ring *ring, uint32_t type, int32_t task_id, const void *payload, uint32_t length);
+
+void frame_reader_init(FrameReader *reader, int fd, Ring *ring);
+void frame_reader_free(FrameReader *reader);
+ssize_t fill_frames(FrameReader *reader);
+int next_frame(FrameReader *reader, FrameHeader *header, const char **payload);
 
-#endif
\ No newline at end of file
+#endif
@@ -1,4 +1,4 @@
-
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -6,51 +6,317 @@
 #include <time.h>
 #include <errno.h>
 #include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/prctl.h>
 #include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
 #include "io_helpers.h"
+#include "ring.h"
 
-#define CORE_NUM 3
+#define MAX_EVENTS 64
+#define SIGNAL_EVENT UINT32_MAX  //epoll tag of the signalfd; cores are tagged with their index
 
-void assign_task(int task_id, int max_bits, int core, int main_to_core[CORE_NUM][2]) {
-    int n = rand() % (max_bits + 1); //random integer between 0 and max_bits
-    
-    char task[128]; 
-    snprintf(task, sizeof(task), "%d_%d", task_id, n);
-    
-    printf("\033[1;34m[MAIN]\033[0m Assign \033[1;35m%d_%d\033[0m to \033[1;36mCore %d\033[0m\n", task_id, n, core + 1);
+int core_num;  //number of cores, -n on the command line (default: online CPUs)
+int use_rings;  //-t shm: shared-memory rings instead of pipes
+long work_usec = 1000000;  //-w: simulated work per bit-extraction task
+int quiet;  //-q: no per-task logs, for benchmarking
+int queue_depth = 1;  //-d: most tasks a core holds at once
+int batch_size = 1;   //-b: tasks sent (and answered) in one frame
+
+#define MAX_QUEUE_DEPTH 256  //size of the per-core queue arrays; bytes are bounded separately
+
+// A cache-configuration sweep: every combination of set bits in
+// [0, max_set_bits], lines in {1, 2, 4, ..., max_lines} and block bits in
+// [0, max_block_bits] is simulated on `trace_file` as one task.
+typedef struct {
+    const char *trace_file;  // NULL when running bit-extraction tasks
+    int max_set_bits;
+    int line_steps;          // number of line counts: 1, 2, 4, ...
+    int max_block_bits;
+} Sweep;
+
+typedef struct {
+    int set_bits, lines, block_bits;
+    int hits, cold, conflict;
+    int error;    // errno of why the core could not simulate it, 0 if it did
+    int crashed;  // signal that killed the core running it, 0 if it finished
+} SweepResult;
+
+// Results of bit-extraction tasks, per core in arrival order; grows as needed.
+typedef struct {
+    int *values;
+    int count;
+    int capacity;
+} ResultList;
+
+// Batches sent to a core and not answered yet, oldest first, in a circular
+// array of queue_depth entries. A batch is `count` task ids from `first`,
+// sent as a frame of `size` bytes. The frames queued on a core never add up
+// to more than max_bytes, half of its pipe or ring, so main's writes always
+// fit: main never waits on a core that is busy or dead.
+typedef struct {
+    int *first;
+    int *count;
+    int *size;
+    int head;     // index of the oldest batch
+    int batches;
+    int tasks;    // in all the batches
+    size_t bytes; // of all their frames
+    size_t max_bytes;
+} TaskQueue;
+
+// Tasks no core holds: those of cores that died (retried one per batch, so a
+// task that crashes its core ends up alone and is recorded as crashed), then
+// the ids from `next` up to `total`.
+typedef struct {
+    int next;
+    int total;
+    int *retry;   // room for every task the cores can hold
+    int retries;
+} Backlog;
+
+pid_t *core_pid;    //pid of the process currently acting as each core
+TaskQueue *core_queue;  //tasks each core holds
+FrameReader *core_reader;  //frames arriving on each core_to_main read end
+int *core_garbled;  //cores killed for a corrupt frame: the rest of their stream is not read
+int *core_killed;   //cores main killed itself: none of their tasks is to blame
+Ring **core_rings;  //with -t shm, each core's rings: main to core, core to main
+int *core_ring_fd;  //memfd of those rings until the core has them
+
+void *allocate(size_t count, size_t size) {
+    void *p = calloc(count, size);
+    if (p == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+void append_result(ResultList *list, int value) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 64;
+        list->values = realloc(list->values, list->capacity * sizeof(int));
+        if (list->values == NULL) {
+            perror("realloc results");
+            exit(EXIT_FAILURE);
+        }
+    }
+    list->values[list->count++] = value;
+}
+
+void queue_push(TaskQueue *queue, int first, int count, int size) {
+    int tail = (queue->head + queue->batches) % queue_depth;
+    queue->first[tail] = first;
+    queue->count[tail] = count;
+    queue->size[tail] = size;
+    queue->batches++;
+    queue->tasks += count;
+    queue->bytes += size;
+}
+
+void queue_pop(TaskQueue *queue) {
+    queue->tasks -= queue->count[queue->head];
+    queue->bytes -= queue->size[queue->head];
+    queue->head = (queue->head + 1) % queue_depth;
+    queue->batches--;
+}
+
+// Gives up on a core that cannot take a frame or sent a corrupt one; once it
+// is reaped, every task it held is retried.
+void kill_core(int core) {
+    core_killed[core] = 1;
+    kill(core_pid[core], SIGKILL);
+}
+
+void assign_task(int first, int count, int max_bits, int core, int main_to_core[][2]) {
+    int32_t n[count];  //the tasks are first, first + 1, ...
+    for (int i = 0; i < count; ++i) {
+        n[i] = rand() % (max_bits + 1); //random integer between 0 and max_bits
+        if (!quiet)
+            printf("\033[1;34m[MAIN]\033[0m Assign \033[1;35m%d_%d\033[0m to \033[1;36mCore %d\033[0m\n", first + i, n[i], core + 1);
+    }
     
-    if (write_all(main_to_core[core][1], task, strlen(task) + 1) == -1) {
-        fprintf(stderr, "Assigning failed!");
+    //a core that cannot take it is killed, so its tasks are retried elsewhere
+    if (write_frame(main_to_core[core][1], core_rings[core], FRAME_BITS_TASK, first, n, sizeof(n)) == -1) {
+        fprintf(stderr, "Assigning to Core %d failed\n", core + 1);
+        kill_core(core);
+    }
+}
+
+void sweep_config(const Sweep *sweep, int task_id, SweepResult *config) {
+    config->block_bits = task_id % (sweep->max_block_bits + 1);
+    task_id /= sweep->max_block_bits + 1;
+    config->lines = 1 << (task_id % sweep->line_steps);
+    config->set_bits = task_id / sweep->line_steps;
+}
+
+// Bytes of the frame that sends `count` tasks.
+size_t task_frame_size(const Sweep *sweep, int count) {
+    if (sweep->trace_file == NULL)
+        return sizeof(FrameHeader) + count * sizeof(int32_t);
+    return sizeof(FrameHeader) + sizeof(int32_t) + count * sizeof(CacheTask) + strlen(sweep->trace_file);
+}
+
+void assign_cache_task(int first, int count, const Sweep *sweep, int core, int main_to_core[][2]) {
+    //the count, count CacheTasks, then the trace path
+    size_t path_length = strlen(sweep->trace_file);
+    char payload[sizeof(int32_t) + count * sizeof(CacheTask) + path_length];
+    int32_t count32 = count;
+    memcpy(payload, &count32, sizeof(count32));
+    for (int i = 0; i < count; ++i) {
+        SweepResult config;
+        sweep_config(sweep, first + i, &config);
+        CacheTask task = { config.set_bits, config.lines, config.block_bits };
+        memcpy(payload + sizeof(count32) + i * sizeof(task), &task, sizeof(task));
+        if (!quiet)
+            printf("\033[1;34m[MAIN]\033[0m Assign cache \033[1;35ms=%d E=%d b=%d\033[0m to \033[1;36mCore %d\033[0m\n",
+                   config.set_bits, config.lines, config.block_bits, core + 1);
+    }
+    memcpy(payload + sizeof(count32) + count * sizeof(CacheTask), sweep->trace_file, path_length);
+
+    //a dead core is noticed and replaced by reap_crashed_cores(); one that
+    //cannot take the frame is killed so that it is too
+    if (write_frame(main_to_core[core][1], core_rings[core], FRAME_CACHE_TASK, first, payload, sizeof(payload)) == -1) {
+        fprintf(stderr, "Assigning to Core %d failed\n", core + 1);
+        kill_core(core);
+    }
+}
+
+//a result is announced by its pipe becoming readable; the only signal left
+//is SIGCHLD, blocked and read from a signalfd so a crashed core wakes the
+//event loop like any result does
+int signal_handling_setup() {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1) {
+        perror("sigprocmask");
         exit(EXIT_FAILURE);
     }
+
+    int signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd == -1) {
+        perror("signalfd");
+        exit(EXIT_FAILURE);
+    }
+    return signal_fd;
 }
 
-volatile sig_atomic_t msg_num_core[CORE_NUM] = {0};
-void handler(int sig) {
-    msg_num_core[sig - SIGRTMIN]++;
+void watch_fd(int epoll_fd, int fd, uint32_t tag) {
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.u32 = tag;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        perror("epoll_ctl");
+        exit(EXIT_FAILURE);
+    }
 }
 
-void signal_handling_setup() {
-    struct sigaction sa;
-    memset(&sa, 0, sizeof(sa));       
-    sa.sa_handler = handler;         
-    sigemptyset(&sa.sa_mask);         
-    sa.sa_flags = 0;                 
+void parse_sweep_args(char *argv[], int *num_tasks, Sweep *sweep) {
+    char *end1, *end2, *end3;
+    sweep->trace_file = argv[2];
+    if (strlen(sweep->trace_file) >= 4096) {
+        fprintf(stderr, "The trace file path is too long.\n");
+        exit(EXIT_FAILURE);
+    }
+    sweep->max_set_bits = strtol(argv[3], &end1, 10);
+    int max_lines = strtol(argv[4], &end2, 10);
+    sweep->max_block_bits = strtol(argv[5], &end3, 10);
 
-    for(int i = 0; i < CORE_NUM; ++i) {
-        if (sigaction(SIGRTMIN + i, &sa, NULL) == -1) {
-            fprintf(stderr, "Failed to register signal handler for SIGRTMIN + %d: ", i);
-            perror("");
-            exit(EXIT_FAILURE);
-        }
+    if (*end1 != '\0' || *end2 != '\0' || *end3 != '\0' || sweep->max_set_bits < 0 ||
+        max_lines <= 0 || sweep->max_block_bits < 0) {
+        fprintf(stderr, "Sweep bounds must be non-negative integers (lines positive).\n");
+        exit(EXIT_FAILURE);
     }
+
+    sweep->line_steps = 0;
+    for (int lines = 1; lines <= max_lines; lines <<= 1)
+        sweep->line_steps++;
+    *num_tasks = (sweep->max_set_bits + 1) * sweep->line_steps * (sweep->max_block_bits + 1);
+}
+
+void usage(const char *program) {
+    fprintf(stderr, "Usage: %s [options] <num_tasks> <max_bits>\n", program);
+    fprintf(stderr, "       %s [options] sweep <trace_file> <max_set_bits> <max_lines> <max_block_bits>\n", program);
+    fprintf(stderr, "  -n cores     number of cores (default: online CPUs)\n");
+    fprintf(stderr, "  -t pipe|shm  transport between main and cores (default: pipe)\n");
+    fprintf(stderr, "  -w usec      simulated work per bit-extraction task (default: 1000000)\n");
+    fprintf(stderr, "  -d depth     most tasks queued on a core at once, 1 to %d (default: 1)\n", MAX_QUEUE_DEPTH);
+    fprintf(stderr, "  -b batch     tasks per frame, 1 to depth (default: 1)\n");
+    fprintf(stderr, "  -q           no per-task logs; report the throughput instead\n");
+    exit(EXIT_FAILURE);
 }
 
-void parse_args(int argc, char *argv[], int *num_tasks, int *max_bits) {
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s <num_tasks> <max_bits>\n", argv[0]);
+void parse_args(int argc, char *argv[], int *num_tasks, int *max_bits, Sweep *sweep) {
+    const char *program = argv[0];
+    int opt;
+    core_num = sysconf(_SC_NPROCESSORS_ONLN);
+    while ((opt = getopt(argc, argv, "n:t:w:d:b:q")) != -1) {
+        char *end;
+        switch (opt) {
+        case 'n':
+            core_num = strtol(optarg, &end, 10);
+            if (*end != '\0' || core_num <= 0) {
+                fprintf(stderr, "The number of cores must be a positive integer.\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 't':
+            if (strcmp(optarg, "shm") != 0 && strcmp(optarg, "pipe") != 0)
+                usage(program);
+            use_rings = strcmp(optarg, "shm") == 0;
+            break;
+        case 'w':
+            work_usec = strtol(optarg, &end, 10);
+            if (*end != '\0' || work_usec < 0) {
+                fprintf(stderr, "The work per task must be a non-negative number of microseconds.\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'd':
+            queue_depth = strtol(optarg, &end, 10);
+            if (*end != '\0' || queue_depth <= 0 || queue_depth > MAX_QUEUE_DEPTH) {
+                fprintf(stderr, "The queue depth must be between 1 and %d.\n", MAX_QUEUE_DEPTH);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'b':
+            batch_size = strtol(optarg, &end, 10);
+            if (*end != '\0' || batch_size <= 0) {
+                fprintf(stderr, "The batch size must be a positive integer.\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'q':
+            quiet = 1;
+            break;
+        default:
+            usage(program);
+        }
+    }
+    if (core_num <= 0)
+        core_num = 1;
+    if (batch_size > queue_depth) {
+        fprintf(stderr, "The batch size cannot exceed the queue depth.\n");
         exit(EXIT_FAILURE);
     }
+    //positional arguments keep their indexes from argv[1] on
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    sweep->trace_file = NULL;
+    if (argc == 6 && strcmp(argv[1], "sweep") == 0) {
+        parse_sweep_args(argv, num_tasks, sweep);
+        *max_bits = 0;
+        return;
+    }
+
+    if (argc != 3)
+        usage(program);
 
     char *endptr1, *endptr2;
     *num_tasks = strtol(argv[1], &endptr1, 10);
@@ -62,7 +328,15 @@ void parse_args(int argc, char *argv[], int *num_tasks, int *max_bits) {
     }
 }
 
-void create_core(int i, int main_to_core[CORE_NUM][2], int core_to_main[CORE_NUM][2]) {
+pid_t create_core(int i, int main_to_core[][2], int core_to_main[][2]) {
+    pid_t main_pid = getpid();
+    //the parent's ends must not leak into cores forked later (or respawned)
+    if (fcntl(main_to_core[i][1], F_SETFD, FD_CLOEXEC) == -1 ||
+        fcntl(core_to_main[i][0], F_SETFD, FD_CLOEXEC) == -1) {
+        perror("fcntl FD_CLOEXEC");
+        exit(EXIT_FAILURE);
+    }
+
     pid_t pid = fork();
     if (pid < 0) {
         perror("fork");
@@ -70,7 +344,8 @@ void create_core(int i, int main_to_core[CORE_NUM][2], int core_to_main[CORE_NUM
     }
 
     if (pid) {
-        printf("\033[1;34m[MAIN]\033[0m \033[1;36mCore %d\033[0m created\n", i + 1);
+        if (!quiet)
+            printf("\033[1;34m[MAIN]\033[0m \033[1;36mCore %d\033[0m created\n", i + 1);
         if (close(main_to_core[i][0]) == -1) {  
             perror("close main_to_core[i][0]");
             exit(EXIT_FAILURE);
@@ -79,78 +354,354 @@ void create_core(int i, int main_to_core[CORE_NUM][2], int core_to_main[CORE_NUM
             perror("close core_to_main[i][1]");
             exit(EXIT_FAILURE);
         }
+        if (core_rings[i] != NULL && close(core_ring_fd[i]) == -1) {  //mapped in main already
+            perror("close ring memfd");
+            exit(EXIT_FAILURE);
+        }
+        core_pid[i] = pid;
     } else {
-        for (int j = 0; j <= i; ++j) {   //Close all unrelated pipes
-            if (close(main_to_core[j][1]) == -1) {
-                perror("close main_to_core[j][1]");
-                exit(EXIT_FAILURE);
-            }
-            if (close(core_to_main[j][0]) == -1) {
-                perror("close core_to_main[j][0]");
-                exit(EXIT_FAILURE);
-            }
+        //a core blocked on its eventfd would never see main go away; this
+        //survives the exec. Main may already be gone by the time it is set.
+        if (prctl(PR_SET_PDEATHSIG, SIGKILL) == -1 || getppid() != main_pid)
+            _exit(EXIT_FAILURE);
+
+        //unrelated pipe ends are FD_CLOEXEC and go away with the exec below
+        sigset_t none;
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, NULL);  //main's blocked SIGCHLD is not the core's
+
+        //the core maps its rings from the memfd, which must survive the exec
+        int ring_fd = -1;
+        if (core_rings[i] != NULL) {
+            ring_fd = core_ring_fd[i];
+            fcntl(ring_fd, F_SETFD, 0);
         }
 
-        //prepare id, write_fd, read_fd to send to child 
-        char id_str[12], fd_read_str[12], fd_write_str[12];
+        //prepare id, read_fd, write_fd, work, quiet and ring_fd to send to child 
+        char id_str[12], fd_read_str[12], fd_write_str[12], work_str[24], quiet_str[12], ring_str[12];
         snprintf(id_str, sizeof(id_str), "%d", i);
         snprintf(fd_read_str, sizeof(fd_read_str), "%d", main_to_core[i][0]);
         snprintf(fd_write_str, sizeof(fd_write_str), "%d", core_to_main[i][1]);
+        snprintf(work_str, sizeof(work_str), "%ld", work_usec);
+        snprintf(quiet_str, sizeof(quiet_str), "%d", quiet);
+        snprintf(ring_str, sizeof(ring_str), "%d", ring_fd);
 
-        char *argv[] = { "./process", id_str, fd_read_str, fd_write_str, NULL };
+        char *argv[] = { "./process", id_str, fd_read_str, fd_write_str, work_str, quiet_str, ring_str, NULL };
         execvp("./process", argv);
         perror("exec failed");
         exit(EXIT_FAILURE);
     }
+    return pid;
 }
 
-void initialize_cores(int idle[], int main_to_core[CORE_NUM][2], int core_to_main[CORE_NUM][2]) {
-    for (int i = 0; i < CORE_NUM; ++i) {
-        if (pipe(main_to_core[i]) == -1) {
-            perror("pipe (main_to_core)");
-            exit(EXIT_FAILURE);
+// With rings, each direction's "pipe" is an eventfd, dup()ed so that main
+// and the core have an end each, as with a pipe: the consumer sleeps on it,
+// the producer writes it. Main's end of core_to_main is non-blocking for the
+// event loop; the core sleeps on main_to_core. The rings are mapped here and
+// in the core.
+void open_core_rings(int i, int main_to_core[][2], int core_to_main[][2]) {
+    core_rings[i] = create_rings(&core_ring_fd[i]);
+    main_to_core[i][0] = eventfd(0, 0);
+    core_to_main[i][0] = eventfd(0, EFD_NONBLOCK);
+    if (core_rings[i] == NULL || main_to_core[i][0] == -1 || core_to_main[i][0] == -1 ||
+        (main_to_core[i][1] = dup(main_to_core[i][0])) == -1 ||
+        (core_to_main[i][1] = dup(core_to_main[i][0])) == -1) {
+        perror("open core rings");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void open_core_pipes(int i, int main_to_core[][2], int core_to_main[][2]) {
+    if (use_rings) {
+        open_core_rings(i, main_to_core, core_to_main);
+        core_queue[i].max_bytes = RING_SIZE / 2;
+        return;
+    }
+
+    if (pipe(main_to_core[i]) == -1) {
+        perror("pipe (main_to_core)");
+        exit(EXIT_FAILURE);
+    }
+
+    if (pipe(core_to_main[i]) == -1) {
+        perror("pipe (core_to_main)");
+        exit(EXIT_FAILURE);
+    }
+
+    //the event loop reads until EAGAIN, and never blocks on one core: a
+    //write that does not fit fails instead (max_bytes keeps that from happening)
+    if (fcntl(core_to_main[i][0], F_SETFL, O_NONBLOCK) == -1 ||
+        fcntl(main_to_core[i][1], F_SETFL, O_NONBLOCK) == -1) {
+        perror("fcntl O_NONBLOCK");
+        exit(EXIT_FAILURE);
+    }
+
+    //half the pipe: its space is handed out a page at a time
+    int capacity = fcntl(main_to_core[i][1], F_GETPIPE_SZ);
+    core_queue[i].max_bytes = (capacity > 0 ? capacity : 4096) / 2;
+}
+
+void initialize_cores(int epoll_fd, int main_to_core[][2], int core_to_main[][2]) {
+    for (int i = 0; i < core_num; ++i) {
+        open_core_pipes(i, main_to_core, core_to_main);
+        create_core(i, main_to_core, core_to_main);
+        watch_fd(epoll_fd, core_to_main[i][0], i);
+        frame_reader_init(&core_reader[i], core_to_main[i][0], core_rings[i] ? &core_rings[i][1] : NULL);
+    }
+}
+
+// Sends batches to the core until it holds queue_depth tasks, its frames
+// would outgrow max_bytes, or the backlog is empty. Retried tasks go one per
+// batch; new ones batch_size at a time, and a batch is only sent whole.
+void dispatch(Backlog *backlog, int max_bits, const Sweep *sweep, int core, int main_to_core[][2]) {
+    TaskQueue *queue = &core_queue[core];
+    while (queue->tasks < queue_depth) {
+        int retry = backlog->retries > 0;
+        int first, count;
+        if (retry) {
+            first = backlog->retry[backlog->retries - 1];
+            count = 1;
+        } else {
+            int left = backlog->total - backlog->next;
+            count = left < batch_size ? left : batch_size;
+            if (count == 0 || count > queue_depth - queue->tasks)
+                return;
+            first = backlog->next;
+        }
+        //an idle core always takes one batch: the largest frame is far below max_bytes
+        size_t size = task_frame_size(sweep, count);
+        if (queue->batches > 0 && queue->bytes + size > queue->max_bytes)
+            return;
+        if (retry)
+            backlog->retries--;
+        else
+            backlog->next += count;
+
+        queue_push(queue, first, count, size);
+        if (sweep->trace_file != NULL)
+            assign_cache_task(first, count, sweep, core, main_to_core);
+        else
+            assign_task(first, count, max_bits, core, main_to_core);
+    }
+}
+
+// Handles every complete result frame in the core's reader; each answers the
+// core's oldest batch. Adds the number of results to *received. Returns -1
+// on a corrupt frame (an answer to anything but the oldest batch, tasks past
+// num_tasks, an unknown type or a length that does not fit the batch), 0
+// otherwise.
+int handle_results(int core, FrameReader *reader, int num_tasks, SweepResult *sweep_results,
+                   ResultList results[], int *received) {
+    TaskQueue *queue = &core_queue[core];
+    FrameHeader header;
+    const char *payload;
+    int status;
+    while ((status = next_frame(reader, &header, &payload)) == 1) {
+        if (queue->batches == 0 || header.task_id != queue->first[queue->head]) {
+            fprintf(stderr, "Unexpected result for task %d from Core %d\n", header.task_id, core + 1);
+            return -1;
         }
-        
-        if (pipe(core_to_main[i]) == -1) {
-            perror("pipe (core_to_main)");
+        int count = queue->count[queue->head];
+        if (header.task_id < 0 || header.task_id > num_tasks - count) {
+            fprintf(stderr, "Result for tasks %d+%d out of range from Core %d\n", header.task_id, count, core + 1);
+            return -1;
+        }
+
+        if (header.type == FRAME_CACHE_RESULT && header.length == count * sizeof(CacheResult) &&
+            sweep_results != NULL) {
+            for (int i = 0; i < count; ++i) {
+                CacheResult result;
+                memcpy(&result, payload + i * sizeof(result), sizeof(result));
+                SweepResult *r = &sweep_results[header.task_id + i];
+                r->hits = result.hits;
+                r->cold = result.cold;
+                r->conflict = result.conflict;
+                r->error = result.error;
+                if (quiet)
+                    continue;
+                if (result.error)
+                    printf("\033[1;34m[MAIN]\033[0m Received failure from \033[1;36mCore %d\033[0m: \033[1;31m%s\033[0m\n",
+                           core + 1, strerror(result.error));
+                else
+                    printf("\033[1;34m[MAIN]\033[0m Received result from \033[1;36mCore %d\033[0m: \033[1;33m%d %d %d\033[0m\n",
+                           core + 1, result.hits, result.cold, result.conflict);
+            }
+        } else if (header.type == FRAME_BITS_RESULT && header.length == count * sizeof(int32_t)) {
+            for (int i = 0; i < count; ++i) {
+                int32_t value;
+                memcpy(&value, payload + i * sizeof(value), sizeof(value));
+                append_result(&results[core], value);  //store to the core's results
+                if (!quiet)
+                    printf("\033[1;34m[MAIN]\033[0m Received result from \033[1;36mCore %d\033[0m: \033[1;33m%d\033[0m\n", core + 1, value);
+            }
+        } else {
+            fprintf(stderr, "Unexpected frame type %u (%u bytes) from Core %d\n", header.type, header.length, core + 1);
+            return -1;
+        }
+        queue_pop(queue);
+        *received += count;
+    }
+    return status;
+}
+
+// Reads what a core's pipe has and handles the results in it, adding their
+// number to *received. A ring is read until empty, which marks main as
+// sleeping on it so the core wakes it for the next result. Returns -1 at EOF
+// (the core died, and SIGCHLD will bring it back) or on a corrupt frame, 0
+// otherwise.
+int receive_results(int core, int num_tasks, SweepResult *sweep_results, ResultList results[], int *received) {
+    FrameReader *reader = &core_reader[core];
+    ssize_t n;
+    while ((n = fill_frames(reader)) > 0) {
+        if (handle_results(core, reader, num_tasks, sweep_results, results, received) == -1) {
+            core_garbled[core] = 1;
+            return -1;
+        }
+        if (reader->ring == NULL)
+            break;  //one read per wakeup; epoll reports whatever is left
+    }
+    if (n == 0 || (n == -1 && errno != EAGAIN))
+        return -1;
+    return 0;
+}
+
+// Replaces any core that died (e.g. a configuration that crashed the
+// simulator) with a fresh one. The results it sent before dying are handled
+// first; it was then running the first task of its oldest unanswered batch:
+// if that batch is that one task, it is recorded as crashed; every other task
+// it held goes back to the backlog, to be retried alone. A core main killed
+// crashed on nothing, so all of its tasks go back.
+void reap_crashed_cores(int *completed_task, Backlog *backlog, int num_tasks, SweepResult *sweep_results,
+                        ResultList results[], int epoll_fd, int main_to_core[][2], int core_to_main[][2]) {
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        int core = 0;
+        while (core < core_num && core_pid[core] != pid)
+            ++core;
+        if (core == core_num)
+            continue;
+
+        //until EOF (a pipe) or EAGAIN (a ring's eventfd): nothing more will come
+        if (!core_garbled[core]) {
+            int received = 0;
+            while (fill_frames(&core_reader[core]) > 0 &&
+                   handle_results(core, &core_reader[core], num_tasks, sweep_results, results, &received) == 0)
+                ;
+            *completed_task += received;
+        }
+        core_garbled[core] = 0;
+
+        TaskQueue *queue = &core_queue[core];
+        int sig = WIFSIGNALED(status) ? WTERMSIG(status) : 0;
+        int killed = core_killed[core];
+        core_killed[core] = 0;
+        if (killed)
+            printf("\033[1;34m[MAIN]\033[0m \033[1;36mCore %d\033[0m killed, restarting it\n", core + 1);
+        else
+            printf("\033[1;34m[MAIN]\033[0m \033[1;36mCore %d\033[0m died (signal %d) during task %d, restarting it\n",
+                   core + 1, sig, queue->batches ? queue->first[queue->head] : -1);
+        if (!killed && queue->batches && queue->count[queue->head] == 1) {
+            if (sweep_results != NULL)
+                sweep_results[queue->first[queue->head]].crashed = sig ? sig : -1;
+            ++*completed_task;
+            queue_pop(queue);
+        }
+        while (queue->batches) {
+            for (int i = 0; i < queue->count[queue->head]; ++i)
+                backlog->retry[backlog->retries++] = queue->first[queue->head] + i;
+            queue_pop(queue);
+        }
+
+        //already gone from the epoll set if its EOF was seen first
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, core_to_main[core][0], NULL);
+        if (close(main_to_core[core][1]) == -1 || close(core_to_main[core][0]) == -1) {
+            perror("close pipes of dead core");
             exit(EXIT_FAILURE);
         }
-        
-        create_core(i, main_to_core, core_to_main);
-        idle[i] = 1;  //core is idle after created
+        if (core_rings[core] != NULL)
+            unmap_rings(core_rings[core]);  //whatever the dead core left in them goes too
+        open_core_pipes(core, main_to_core, core_to_main);
+        create_core(core, main_to_core, core_to_main);
+        watch_fd(epoll_fd, core_to_main[core][0], core);
+        core_reader[core].fd = core_to_main[core][0];
+        core_reader[core].ring = core_rings[core] ? &core_rings[core][1] : NULL;
+        core_reader[core].start = core_reader[core].end = 0;  //drop whatever the dead core half-sent
     }
 }
 
-void schedule_tasks(int num_tasks, int max_bits, int idle[], int result[][8192], int result_count[],
-                    int main_to_core[CORE_NUM][2], int core_to_main[CORE_NUM][2]) {
-    int task_id = 0, completed_task = 0;
+// Event loop: blocks in epoll_wait() until a core's pipe is readable or a
+// core died, and tops up only the core that just answered.
+void schedule_tasks(int num_tasks, int max_bits, const Sweep *sweep, SweepResult *sweep_results,
+                    ResultList results[], int epoll_fd, int signal_fd,
+                    int main_to_core[][2], int core_to_main[][2]) {
+    int completed_task = 0;
+    struct epoll_event events[MAX_EVENTS];
+    Backlog backlog = { 0, num_tasks, allocate((size_t)core_num * queue_depth, sizeof(int)), 0 };
+
+    for (int core = 0; core < core_num; ++core)
+        dispatch(&backlog, max_bits, sweep, core, main_to_core);
 
     while (completed_task < num_tasks) {   //keep looping until all tasks are finished
-        for (int core = 0; core < CORE_NUM; ++core) {
-            if (msg_num_core[core] > 0) {  //there is result from core
-                --msg_num_core[core];
-
-                int value;
-                char *msg = read_all(core_to_main[core][0]);  //read result from read-end of pipe
-                sscanf(msg, "%d", &value);
-                free(msg);
-                result[core][result_count[core]++] = value;  //store to result array
-                ++completed_task;
-                printf("\033[1;34m[MAIN]\033[0m Received result from \033[1;36mCore %d\033[0m: \033[1;33m%d\033[0m\n", core + 1, value);
-
-                idle[core] = 1; //set core back to idle state
+        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            exit(EXIT_FAILURE);
+        }
+
+        for (int i = 0; i < n; ++i) {
+            if (events[i].data.u32 == SIGNAL_EVENT) {
+                struct signalfd_siginfo info;
+                while (read(signal_fd, &info, sizeof(info)) == sizeof(info))
+                    ;  //SIGCHLDs coalesce; waitpid() below finds every dead core
+                reap_crashed_cores(&completed_task, &backlog, num_tasks, sweep_results, results,
+                                   epoll_fd, main_to_core, core_to_main);
+                for (int core = 0; core < core_num; ++core)
+                    dispatch(&backlog, max_bits, sweep, core, main_to_core);
+                continue;
             }
 
-            if (task_id < num_tasks && idle[core]) {
-                idle[core] = 0;  //core is no longer idle.
-                assign_task(task_id++, max_bits, core, main_to_core);
+            //a stale event of a core respawned earlier in this batch reads nothing
+            int core = events[i].data.u32;
+            int received = 0;
+            int status = receive_results(core, num_tasks, sweep_results, results, &received);
+            completed_task += received;
+            if (status == -1) {
+                //EOF stays readable; stop watching until the core is reaped.
+                //A core that sent garbage is killed, so it is reaped too.
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, core_to_main[core][0], NULL);
+                if (core_garbled[core])
+                    kill_core(core);
+                continue;
             }
+            if (received == 0)
+                continue;  //only part of the frame has arrived
+            dispatch(&backlog, max_bits, sweep, core, main_to_core);
         }
     }
+    free(backlog.retry);
+}
+
+void print_sweep(int num_tasks, const Sweep *sweep, SweepResult *sweep_results) {
+    for (int task_id = 0; task_id < num_tasks; ++task_id) {
+        SweepResult *r = &sweep_results[task_id];
+        sweep_config(sweep, task_id, r);
+        printf("\033[1;34m[MAIN]\033[0m s=%d E=%d b=%d: ", r->set_bits, r->lines, r->block_bits);
+        if (r->crashed)
+            printf("\033[1;31mcrashed (signal %d)\033[0m\n", r->crashed);
+        else if (r->error)
+            printf("\033[1;31mfailed: %s: %s\033[0m\n", sweep->trace_file, strerror(r->error));
+        else
+            printf("\033[1;33mhits %d cold %d conflict %d\033[0m\n", r->hits, r->cold, r->conflict);
+    }
 }
 
-void finalize(int result[][8192], int result_count[], int main_to_core[CORE_NUM][2], int core_to_main[CORE_NUM][2]) {
-    for (int core = 0; core < CORE_NUM; ++core) {
+void finalize(ResultList results[], int main_to_core[][2], int core_to_main[][2]) {
+    for (int core = 0; core < core_num; ++core) {
+        if (core_rings[core] != NULL)
+            ring_close(&core_rings[core][0], main_to_core[core][1]);  //the core's EOF
         if (close(main_to_core[core][1]) == -1) {
             perror("close main_to_core write-end failed");
             exit(EXIT_FAILURE);
@@ -166,34 +717,96 @@ void finalize(int result[][8192], int result_count[], int main_to_core[CORE_NUM]
             exit(EXIT_FAILURE);
         }
 
-        printf("\033[1;34m[MAIN]\033[0m Reaped and closed pipes for \033[1;36mCore %d\033[0m\n", core + 1);
+        if (core_rings[core] != NULL)
+            unmap_rings(core_rings[core]);
+        if (!quiet)
+            printf("\033[1;34m[MAIN]\033[0m Reaped and closed pipes for \033[1;36mCore %d\033[0m\n", core + 1);
     }
 
-    for (int core = 0; core < CORE_NUM; ++core) {
+    for (int core = 0; core < core_num; ++core) {
         printf("\033[1;34m[MAIN]\033[0m \033[1;36mCore %d\033[0m: ", core + 1); 
+        if (quiet) {
+            printf("\033[1;33m%d results\033[0m\n", results[core].count);
+            free(results[core].values);
+            continue;
+        }
     
-        for (int i = 0; i < result_count[core]; ++i) {
-            printf("\033[1;33m%d\033[0m", result[core][i]);  
-            if (i != result_count[core] - 1)
+        for (int i = 0; i < results[core].count; ++i) {
+            printf("\033[1;33m%d\033[0m", results[core].values[i]);  
+            if (i != results[core].count - 1)
                 printf(", ");
         }
     
         printf("\n");
+        free(results[core].values);
     }    
 }
 
 int main(int argc, char *argv[]) {
     int num_tasks, max_bits;
-    int idle[CORE_NUM] = {0};   //idle status of each core. 0 means NOT idle, 1 means idle.
-    int result[CORE_NUM][8192];  
-    int result_count[CORE_NUM] = {0};
-    int main_to_core[CORE_NUM][2];
-    int core_to_main[CORE_NUM][2];
-
-    parse_args(argc, argv, &num_tasks, &max_bits);
-    signal_handling_setup();
+    Sweep sweep;
+    SweepResult *sweep_results = NULL;
+
+    parse_args(argc, argv, &num_tasks, &max_bits, &sweep);
+    ResultList *results = allocate(core_num, sizeof(ResultList));
+    int (*main_to_core)[2] = allocate(core_num, sizeof(*main_to_core));
+    int (*core_to_main)[2] = allocate(core_num, sizeof(*core_to_main));
+    core_pid = allocate(core_num, sizeof(pid_t));
+    core_queue = allocate(core_num, sizeof(TaskQueue));
+    for (int core = 0; core < core_num; ++core) {
+        core_queue[core].first = allocate(queue_depth, sizeof(int));
+        core_queue[core].count = allocate(queue_depth, sizeof(int));
+        core_queue[core].size = allocate(queue_depth, sizeof(int));
+    }
+    core_reader = allocate(core_num, sizeof(FrameReader));
+    core_garbled = allocate(core_num, sizeof(int));
+    core_killed = allocate(core_num, sizeof(int));
+    core_rings = allocate(core_num, sizeof(Ring *));
+    core_ring_fd = allocate(core_num, sizeof(int));
+    if (sweep.trace_file != NULL)
+        sweep_results = allocate(num_tasks, sizeof(SweepResult));
+    int signal_fd = signal_handling_setup();
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        perror("epoll_create1");
+        exit(EXIT_FAILURE);
+    }
+    watch_fd(epoll_fd, signal_fd, SIGNAL_EVENT);
+    signal(SIGPIPE, SIG_IGN);  //writing to a crashed core must not kill main
     srand(time(NULL));
-    initialize_cores(idle, main_to_core, core_to_main);
-    schedule_tasks(num_tasks, max_bits, idle, result, result_count, main_to_core, core_to_main);
-    finalize(result, result_count, main_to_core, core_to_main);
+    struct timespec started, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    initialize_cores(epoll_fd, main_to_core, core_to_main);
+    schedule_tasks(num_tasks, max_bits, &sweep, sweep_results, results,
+                   epoll_fd, signal_fd, main_to_core, core_to_main);
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    close(epoll_fd);
+    close(signal_fd);
+    finalize(results, main_to_core, core_to_main);
+    if (sweep_results != NULL) {
+        print_sweep(num_tasks, &sweep, sweep_results);
+        free(sweep_results);
+    }
+    if (quiet) {
+        double seconds = (finished.tv_sec - started.tv_sec) + (finished.tv_nsec - started.tv_nsec) / 1e9;
+        printf("\033[1;34m[MAIN]\033[0m %d tasks on %d cores over %s in %.3f s: \033[1;33m%.0f tasks/s\033[0m\n",
+               num_tasks, core_num, use_rings ? "shm rings" : "pipes", seconds, num_tasks / seconds);
+    }
+    free(results);
+    free(main_to_core);
+    free(core_to_main);
+    free(core_pid);
+    for (int core = 0; core < core_num; ++core) {
+        free(core_queue[core].first);
+        free(core_queue[core].count);
+        free(core_queue[core].size);
+    }
+    free(core_queue);
+    for (int core = 0; core < core_num; ++core)
+        frame_reader_free(&core_reader[core]);
+    free(core_reader);
+    free(core_garbled);
+    free(core_killed);
+    free(core_rings);
+    free(core_ring_fd);
 }
\ No newline at end of file
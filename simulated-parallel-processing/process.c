@@ -1,21 +1,23 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
-#include <signal.h>
 #include <time.h>
 #include <errno.h>
 #include <string.h>
 #include "io_helpers.h"
+#include "cache.h"
+#include "cpu.h"
+#include "trace.h"
 
-int extract_leftmost_bits(const char *msg) {
-    int task_id, n;
+//the trace of the last cache task stays resident for the next one
+static Trace *loaded_trace = NULL;
+static char loaded_trace_file[4096];
 
-    //parse "task_id_n"
-    if (sscanf(msg, "%d_%d", &task_id, &n) != 2) {
-        fprintf(stderr, "Invalid task message format: %s\n", msg);
-        return -1;
-    }
+static long work_usec;  //simulated work per bit-extraction task
+static int quiet;       //no per-task logs
+static Ring *rings;     //main to core, core to main; NULL over pipes
 
+int extract_leftmost_bits(int task_id, int n) {
     //get total number of bits in task_id
     int total_bits = 0;
     for (int tmp = task_id; tmp > 0; tmp >>= 1)
@@ -28,59 +30,169 @@ int extract_leftmost_bits(const char *msg) {
     return task_id >> bits_to_discard;
 }
 
-void no_interrupt_sleep(int sec)
+//runs a cache task on the trace at path (path_length bytes, straight from
+//the frame) and fills in result; on failure result->error says why
+int simulate_cache(const CacheTask *task, const char *path, size_t path_length, CacheResult *result) {
+    memset(result, 0, sizeof(*result));
+    if (path_length >= sizeof(loaded_trace_file)) {
+        fprintf(stderr, "Trace path too long\n");
+        result->error = ENAMETOOLONG;
+        return -1;
+    }
+
+    if (loaded_trace == NULL || strlen(loaded_trace_file) != path_length ||
+        memcmp(loaded_trace_file, path, path_length) != 0) {
+        if (loaded_trace != NULL)
+            delete_trace(loaded_trace);
+        memcpy(loaded_trace_file, path, path_length);
+        loaded_trace_file[path_length] = '\0';
+        loaded_trace = load_trace(loaded_trace_file);
+        if (loaded_trace == NULL) {
+            result->error = errno ? errno : EIO;
+            perror(loaded_trace_file);
+            return -1;
+        }
+    }
+
+    Cache *cache = make_cache(task->set_bits, task->lines, task->block_bits);
+    CPU *cpu = make_cpu(cache, NULL);
+    replay_trace(cpu, loaded_trace);
+    result->hits = cpu->hits;
+    result->cold = cpu->cold;
+    result->conflict = cpu->conflict;
+    delete_cpu(cpu);
+    delete_cache(cache);
+    return 0;
+}
+
+void no_interrupt_sleep(long usec)
 {
     // * advanced sleep which will not be interfered by signals
     struct timespec req, rem;
 
-    req.tv_sec = sec;  // The time to sleep in seconds
-    req.tv_nsec = 0; // Additional time to sleep in nanoseconds
+    req.tv_sec = usec / 1000000;  // The time to sleep in seconds
+    req.tv_nsec = usec % 1000000 * 1000; // Additional time to sleep in nanoseconds
 
     while(nanosleep(&req, &rem) == -1)
         if(errno == EINTR)
             req = rem;
 }
 
+//id read_fd write_fd work_usec quiet ring_fd, the last -1 over pipes
 void parse_args(int argc, char *argv[], int *id, int *read_fd, int *write_fd) {
-    if (argc != 4) {
+    int ring_fd;
+    if (argc != 7) {
         fprintf(stderr, "Missing arguments");
         exit(EXIT_FAILURE);
     }
     sscanf(argv[1], "%d", id);
     sscanf(argv[2], "%d", read_fd);
     sscanf(argv[3], "%d", write_fd);
+    sscanf(argv[4], "%ld", &work_usec);
+    sscanf(argv[5], "%d", &quiet);
+    sscanf(argv[6], "%d", &ring_fd);
+
+    if (ring_fd >= 0) {
+        rings = map_rings(ring_fd);
+        if (rings == NULL)
+            exit(EXIT_FAILURE);
+        close(ring_fd);
+    }
 }
 
-void handle_task(int id, const char *msg, int write_fd, int parent_pid) {
-    printf("\033[1;32m[CORE %d]\033[0m Received task \033[1;35m%s\033[0m\n", id + 1, msg);
-    no_interrupt_sleep(1);
+//runs a batch of cache tasks: the count, the CacheTasks, then the trace path
+void handle_cache_tasks(int id, const FrameHeader *header, const char *payload, int write_fd) {
+    int32_t count;
+    memcpy(&count, payload, sizeof(count));
+    if (count <= 0 || header->length < sizeof(count) + count * sizeof(CacheTask)) {
+        fprintf(stderr, "Invalid cache task batch\n");
+        exit(EXIT_FAILURE);  //main reaps the core and retries or blames its tasks
+    }
+    const char *path = payload + sizeof(count) + count * sizeof(CacheTask);
+    size_t path_length = header->length - (path - payload);
+
+    CacheResult results[count];
+    for (int i = 0; i < count; ++i) {
+        CacheTask task;
+        memcpy(&task, payload + sizeof(count) + i * sizeof(task), sizeof(task));
+        if (!quiet)
+            printf("\033[1;32m[CORE %d]\033[0m Received task \033[1;35mC %d %d %d %d %.*s\033[0m\n", id + 1,
+                   header->task_id + i, task.set_bits, task.lines, task.block_bits, (int)path_length, path);
+        if (simulate_cache(&task, path, path_length, &results[i]) == -1) {
+            if (!quiet)
+                printf("\033[1;32m[CORE %d]\033[0m Failed: \033[1;31m%s\033[0m\n", id + 1, strerror(results[i].error));
+        } else if (!quiet) {
+            printf("\033[1;32m[CORE %d]\033[0m Finished with result: \033[1;33m%d %d %d\033[0m\n", id + 1,
+                   results[i].hits, results[i].cold, results[i].conflict);
+        }
+    }
+    //one frame answers the whole batch; the pipe turning readable (or the
+    //ring's eventfd) is what wakes main, no signal needed
+    write_frame(write_fd, rings ? &rings[1] : NULL, FRAME_CACHE_RESULT, header->task_id, results, sizeof(results));
+}
 
-    int extracted = extract_leftmost_bits(msg);
+//runs a batch of bit-extraction tasks back to back: one n per task
+void handle_bits_tasks(int id, const FrameHeader *header, const char *payload, int write_fd) {
+    int count = header->length / sizeof(int32_t);
+    if (count == 0 || header->length % sizeof(int32_t) != 0) {
+        fprintf(stderr, "Invalid task batch\n");
+        exit(EXIT_FAILURE);
+    }
 
-    char result_str[32];
-    snprintf(result_str, sizeof(result_str), "%d", extracted);
+    int32_t results[count];
+    for (int i = 0; i < count; ++i) {
+        int32_t n;
+        memcpy(&n, payload + i * sizeof(n), sizeof(n));
+        if (!quiet)
+            printf("\033[1;32m[CORE %d]\033[0m Received task \033[1;35m%d_%d\033[0m\n", id + 1, header->task_id + i, n);
+        if (work_usec > 0)
+            no_interrupt_sleep(work_usec);
+        results[i] = extract_leftmost_bits(header->task_id + i, n);
+        if (!quiet)
+            printf("\033[1;32m[CORE %d]\033[0m Finished with result: \033[1;33m%d\033[0m\n", id + 1, results[i]);
+    }
+    write_frame(write_fd, rings ? &rings[1] : NULL, FRAME_BITS_RESULT, header->task_id, results, sizeof(results));
+}
 
-    printf("\033[1;32m[CORE %d]\033[0m Finished with result: \033[1;33m%s\033[0m\n", id + 1, result_str);
-    write_all(write_fd, result_str, strlen(result_str) + 1);  //include NULL terminator
-    if (kill(parent_pid, SIGRTMIN + id) == -1) {
-        perror("kill failed");
+void handle_task(int id, const FrameHeader *header, const char *payload, int write_fd) {
+    if (header->type == FRAME_CACHE_TASK && header->length >= sizeof(int32_t)) {
+        //cache simulation task, real work: no simulated delay
+        handle_cache_tasks(id, header, payload, write_fd);
+    } else if (header->type == FRAME_BITS_TASK) {
+        handle_bits_tasks(id, header, payload, write_fd);
+    } else {
+        fprintf(stderr, "Invalid task frame type %u\n", header->type);
         exit(EXIT_FAILURE);
     }
 }
 
 void core_loop(int id, int read_fd, int write_fd) {
-    int parent_pid = getppid();
+    FrameReader reader;
+    frame_reader_init(&reader, read_fd, rings);  //rings[0] comes from main
 
     while (1) {  //core loop, waiting for tasks from main
-        char *msg = read_all(read_fd);
-        if (msg == NULL) break;  //main closed the write-end. core stop the loop
-
-        handle_task(id, msg, write_fd, parent_pid);
-        free(msg);
+        if (fill_frames(&reader) <= 0) break;  //main closed the write-end. core stop the loop
+
+        //every task that arrived with this read, straight from the buffer
+        FrameHeader header;
+        const char *payload;
+        int status;
+        while ((status = next_frame(&reader, &header, &payload)) == 1)
+            handle_task(id, &header, payload, write_fd);
+        if (status == -1) {
+            fprintf(stderr, "Corrupt task stream\n");
+            break;
+        }
     }
+    frame_reader_free(&reader);
 }
 
 void cleanup(int id, int read_fd, int write_fd) {
+    if (rings != NULL) {
+        ring_close(&rings[1], write_fd);
+        unmap_rings(rings);
+    }
+
     if (close(read_fd) == -1) {
         perror("close read_fd failed");
         exit(EXIT_FAILURE);
@@ -91,7 +203,8 @@ void cleanup(int id, int read_fd, int write_fd) {
         exit(EXIT_FAILURE);
     }
 
-    printf("\033[1;32m[CORE %d]\033[0m Closed pipes and exiting\n", id + 1);
+    if (!quiet)
+        printf("\033[1;32m[CORE %d]\033[0m Closed pipes and exiting\n", id + 1);
 }
 
 int main(int argc, char *argv[]) {
@@ -0,0 +1,160 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "ring.h"
+
+#define RINGS_BYTES (2 * sizeof(Ring))
+
+// A memfd holding a pair of empty rings, mapped shared. The fd is
+// close-on-exec; whoever hands it to a core clears that.
+Ring *create_rings(int *fd) {
+    *fd = memfd_create("core-rings", MFD_CLOEXEC);
+    if (*fd == -1) {
+        perror("memfd_create");
+        return NULL;
+    }
+    if (ftruncate(*fd, RINGS_BYTES) == -1) {
+        perror("ftruncate rings");
+        close(*fd);
+        return NULL;
+    }
+    Ring *rings = map_rings(*fd);
+    if (rings == NULL) {
+        close(*fd);
+        return NULL;
+    }
+    //a consumer that has not looked yet (main waiting in epoll) must be woken
+    rings[0].consumer_sleeping = rings[1].consumer_sleeping = 1;
+    return rings;
+}
+
+Ring *map_rings(int fd) {
+    void *p = mmap(NULL, RINGS_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        perror("mmap rings");
+        return NULL;
+    }
+    return p;
+}
+
+void unmap_rings(Ring *rings) {
+    munmap(rings, RINGS_BYTES);
+}
+
+// The futex word lives in memory shared between processes: no FUTEX_PRIVATE_FLAG.
+static void futex_wait(uint32_t *word, uint32_t value) {
+    syscall(SYS_futex, word, FUTEX_WAIT, value, NULL, NULL, 0);
+}
+
+static void futex_wake(uint32_t *word) {
+    syscall(SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+// Makes everything up to head visible and wakes the consumer if it sleeps.
+static void publish(Ring *ring, uint64_t head, int wake_fd) {
+    __atomic_store_n(&ring->head, head, __ATOMIC_SEQ_CST);
+    if (__atomic_exchange_n(&ring->consumer_sleeping, 0, __ATOMIC_SEQ_CST)) {
+        uint64_t one = 1;
+        while (write(wake_fd, &one, sizeof(one)) == -1 && errno == EINTR)
+            ;
+    }
+}
+
+// Sleeps until the consumer has made room (or has already). There is no
+// timeout: main bounds what it queues on a core to half a ring, so only a
+// core waits here, for main, and a core whose main dies is killed
+// (PR_SET_PDEATHSIG).
+static void wait_for_space(Ring *ring, uint64_t head) {
+    __atomic_store_n(&ring->producer_sleeping, 1, __ATOMIC_SEQ_CST);
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) < RING_SIZE) {
+        __atomic_store_n(&ring->producer_sleeping, 0, __ATOMIC_RELAXED);
+        return;
+    }
+    futex_wait(&ring->producer_sleeping, 1);
+}
+
+// Copies the iovecs into the ring and publishes them together. Something
+// larger than the free space goes in pieces, waiting for the consumer in
+// between.
+ssize_t ring_write(Ring *ring, int wake_fd, const struct iovec *iov, int count) {
+    uint64_t head = ring->head;
+    size_t total = 0;
+
+    for (int i = 0; i < count; ++i) {
+        const char *src = iov[i].iov_base;
+        size_t left = iov[i].iov_len;
+        while (left > 0) {
+            size_t space = RING_SIZE - (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE));
+            if (space == 0) {
+                publish(ring, head, wake_fd);
+                wait_for_space(ring, head);
+                continue;
+            }
+
+            size_t offset = head % RING_SIZE;
+            size_t n = left < space ? left : space;
+            if (n > RING_SIZE - offset)
+                n = RING_SIZE - offset;  //up to the wrap; the rest goes next round
+            memcpy(ring->data + offset, src, n);
+            src += n;
+            left -= n;
+            head += n;
+            total += n;
+        }
+    }
+    publish(ring, head, wake_fd);
+    return total;
+}
+
+// Copies out up to size bytes. An empty ring marks the consumer as sleeping
+// and reads wake_fd: on a blocking eventfd that waits for the producer, on a
+// non-blocking one it fails with EAGAIN and the caller polls wake_fd, as with
+// a non-blocking pipe. Returns 0 once the producer has closed the ring and
+// everything has been read.
+ssize_t ring_read(Ring *ring, int wake_fd, char *buf, size_t size) {
+    uint64_t tail = ring->tail;
+
+    while (1) {
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (head != tail) {
+            size_t available = head - tail;
+            size_t n = available < size ? available : size;
+            size_t offset = tail % RING_SIZE;
+            size_t first = n < RING_SIZE - offset ? n : RING_SIZE - offset;
+            memcpy(buf, ring->data + offset, first);
+            memcpy(buf + first, ring->data, n - first);
+
+            __atomic_store_n(&ring->tail, tail + n, __ATOMIC_SEQ_CST);
+            if (__atomic_exchange_n(&ring->producer_sleeping, 0, __ATOMIC_SEQ_CST))
+                futex_wake(&ring->producer_sleeping);
+            return n;
+        }
+        if (__atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE)) {
+            if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail)
+                return 0;
+            continue;  //the last bytes came in with the close
+        }
+
+        __atomic_store_n(&ring->consumer_sleeping, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) != tail ||
+            __atomic_load_n(&ring->closed, __ATOMIC_SEQ_CST)) {
+            __atomic_store_n(&ring->consumer_sleeping, 0, __ATOMIC_RELAXED);
+            continue;
+        }
+        uint64_t wakeups;
+        if (read(wake_fd, &wakeups, sizeof(wakeups)) == -1 && errno != EINTR)
+            return -1;  //EAGAIN: stays marked sleeping, so the producer will write wake_fd
+    }
+}
+
+// Tells the consumer no more bytes are coming.
+void ring_close(Ring *ring, int wake_fd) {
+    __atomic_store_n(&ring->closed, 1, __ATOMIC_SEQ_CST);
+    publish(ring, ring->head, wake_fd);
+}
@@ -0,0 +1,35 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/uio.h>
+
+#define RING_SIZE (64 << 10)  //bytes of data per ring, a power of two (a pipe's default buffer)
+
+// Single-producer single-consumer byte ring in memory shared by main and one
+// core. head and tail only grow; the data lies at their value mod RING_SIZE.
+// Each side has an eventfd (`wake_fd` below) that the other side writes only
+// when the consumer has said it is about to sleep, so a busy consumer costs
+// the producer no system call. A producer facing a full ring sleeps on a futex.
+typedef struct {
+    // written by the producer
+    uint64_t head __attribute__((aligned(64)));  // bytes ever written
+    uint32_t consumer_sleeping;  // set by the consumer, cleared by whoever wakes it
+    uint32_t closed;             // the producer will write no more
+    // written by the consumer
+    uint64_t tail __attribute__((aligned(64)));  // bytes ever read
+    uint32_t producer_sleeping;  // futex word, set by a producer waiting for space
+    char data[RING_SIZE] __attribute__((aligned(64)));
+} Ring;
+
+// A core's pair of rings: main to core, then core to main.
+Ring *create_rings(int *fd);
+Ring *map_rings(int fd);
+void unmap_rings(Ring *rings);
+
+ssize_t ring_write(Ring *ring, int wake_fd, const struct iovec *iov, int count);
+ssize_t ring_read(Ring *ring, int wake_fd, char *buf, size_t size);
+void ring_close(Ring *ring, int wake_fd);
+
+#endif